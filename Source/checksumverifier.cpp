@@ -0,0 +1,306 @@
+#include "checksumverifier.h"
+
+#include <qstringlist.h>
+#include <qdebug.h>
+
+// Checksum commands sent ahead on the session.
+static const int MaxRunning = 8;
+
+/*!
+    \class ChecksumVerifier checksumverifier.h
+
+    \brief The ChecksumVerifier class compares transferred files with
+    the checksum the server computes of them.
+
+    The server is asked on a session of its own, with HASH where FEAT
+    announces it and with XCRC, XMD5 or XSHA1 otherwise. CRC-32 is
+    preferred as it costs the server the least, then MD5 and SHA-1. The
+    local checksum is computed by a FileHasher at the same time. An
+    upload can be hashed with prepare() as soon as it starts, so the
+    local side is ready when the transfer is over.
+
+    verified() reports Unverified where the server offers no checksum,
+    refuses it or the file cannot be read.
+
+    \sa FileHasher, TransferPool
+*/
+
+ChecksumVerifier::ChecksumVerifier(FileHasher *hasher, QObject *parent)
+    : QObject(parent), hasher(hasher), ftp(0), loggingIn(false), chosen(false),
+    algorithm(FileHasher::Crc32), selecting(0), current(0)
+{
+    connect(hasher, SIGNAL(hashed(const QString &, int, const QByteArray &)),
+            this, SLOT(hashed(const QString &, int, const QByteArray &)));
+}
+
+ChecksumVerifier::~ChecksumVerifier()
+{
+    delete ftp;
+}
+
+/*!
+    Sets the server and the credentials to \a url.
+ */
+void ChecksumVerifier::setUrl(const QUrl &url)
+{
+    if (url == ftpUrl)
+        return;
+    abort();
+    ftpUrl = url;
+}
+
+/*!
+    Starts hashing the local file \a localPath, which is about to be
+    uploaded, once the server tells which checksum it offers.
+ */
+void ChecksumVerifier::prepare(const QString &localPath)
+{
+    if (!chosen || selecting) {
+        if (!preparing.contains(localPath))
+            preparing.append(localPath);
+        pump();
+    } else if (!command.isEmpty()) {
+        hasher->hash(localPath, algorithm);
+    }
+}
+
+/*!
+    Compares the local file \a localPath with the remote file
+    \a remotePath for the transfer \a id.
+ */
+void ChecksumVerifier::verify(int id, const QString &localPath, const QString &remotePath)
+{
+    Check check;
+    check.localPath = localPath;
+    check.remotePath = remotePath;
+    checks.insert(id, check);
+    waiting.append(id);
+    pump();
+}
+
+/*!
+    Gives up all checks and closes the session.
+ */
+void ChecksumVerifier::abort()
+{
+    giveUp();
+    loggingIn = false;
+    chosen = false;
+    selecting = 0;
+    current = 0;
+    if (ftp) {
+        ftp->disconnect(this);
+        ftp->abort();
+        ftp->close();
+        ftp->deleteLater();
+        ftp = 0;
+    }
+}
+
+void ChecksumVerifier::pump()
+{
+    if ((waiting.isEmpty() && preparing.isEmpty()) || ftpUrl.isEmpty())
+        return;
+    if (!ftp) {
+        ftp = new FtpEngine(this);
+        connect(ftp, SIGNAL(stateChanged(int)), this, SLOT(stateChanged(int)));
+        connect(ftp, SIGNAL(commandStarted(int)), this, SLOT(commandStarted(int)));
+        connect(ftp, SIGNAL(rawCommandReply(int, const QString &)),
+                this, SLOT(rawCommandReply(int, const QString &)));
+        connect(ftp, SIGNAL(commandFinished(int, bool)), this, SLOT(commandFinished(int, bool)));
+    }
+    if (ftp->state() == QFtp::Unconnected && !loggingIn) {
+        loggingIn = true;
+        ftp->connectToHost(ftpUrl.host(), ftpUrl.port(21));
+        ftp->login(ftpUrl.userName(), ftpUrl.password());
+        return;
+    }
+    if (ftp->state() != QFtp::LoggedIn)
+        return;
+    if (!chosen)
+        choose();
+    if (selecting)
+        return;
+    if (command.isEmpty()) {
+        giveUp();
+        return;
+    }
+
+    foreach (const QString &path, preparing)
+        hasher->hash(path, algorithm);
+    preparing.clear();
+    while (running.count() < MaxRunning && !waiting.isEmpty()) {
+        int id = waiting.takeFirst();
+        const Check &check = checks[id];
+        hasher->hash(check.localPath, algorithm);
+        running.insert(ftp->rawCommand(command + ' ' + check.remotePath), id);
+    }
+}
+
+/*!
+    Picks the checksum command from what the server announced. HASH is
+    switched to the algorithm with OPTS where it is not the current one.
+ */
+void ChecksumVerifier::choose()
+{
+    static const FileHasher::Algorithm preferred[] = {
+        FileHasher::Crc32, FileHasher::Md5, FileHasher::Sha1
+    };
+    static const char * const commands[] = { "XCRC", "XMD5", "XSHA1" };
+
+    chosen = true;
+    command.clear();
+    if (ftp->hasFeature("HASH") && !selecting) {
+        QStringList offered = ftp->featureParameters("HASH").split(';');
+        for (int i = 0; i < 3 && command.isEmpty(); ++i) {
+            QString name = FileHasher::algorithmName(preferred[i]);
+            foreach (const QString &offer, offered) {
+                QString trimmed = offer.trimmed();
+                bool active = trimmed.endsWith('*');
+                if (active)
+                    trimmed.chop(1);
+                if (trimmed.compare(name, Qt::CaseInsensitive) != 0)
+                    continue;
+                algorithm = preferred[i];
+                command = "HASH";
+                if (!active)
+                    selecting = ftp->rawCommand("OPTS HASH " + name);
+                break;
+            }
+        }
+        if (!command.isEmpty())
+            return;
+    }
+    for (int i = 0; i < 3; ++i) {
+        if (ftp->hasFeature(commands[i])) {
+            algorithm = preferred[i];
+            command = commands[i];
+            return;
+        }
+    }
+}
+
+void ChecksumVerifier::stateChanged(int state)
+{
+    if (state == QFtp::LoggedIn) {
+        loggingIn = false;
+        pump();
+    } else if (state == QFtp::Unconnected) {
+        // Asked again on the next session.
+        loggingIn = false;
+        chosen = false;
+        selecting = 0;
+        current = 0;
+        waiting = running.values() + waiting;
+        running.clear();
+    }
+}
+
+void ChecksumVerifier::commandStarted(int id)
+{
+    current = id;
+    reply.clear();
+}
+
+void ChecksumVerifier::rawCommandReply(int code, const QString &detail)
+{
+    if (current && code / 100 == 2)
+        reply = detail.trimmed();
+}
+
+void ChecksumVerifier::commandFinished(int id, bool error)
+{
+    current = 0;
+    if (loggingIn && error) {
+        qWarning() << "ChecksumVerifier" << ftp->errorString();
+        abort();
+        return;
+    }
+    if (id == selecting) {
+        // Without the algorithm HASH is no use, the X commands may be.
+        if (error) {
+            chosen = false;
+            choose();
+        }
+        selecting = 0;
+        pump();
+        return;
+    }
+    if (!running.contains(id))
+        return;
+    int transfer = running.take(id);
+    if (error) {
+        // The engine dropped what was sent behind the failed command.
+        waiting = running.values() + waiting;
+        running.clear();
+    }
+
+    Check &check = checks[transfer];
+    check.remoteDone = true;
+    if (!error) {
+        // "HASH" answers "<algorithm> <range> <hex> <path>", the X
+        // commands the hex checksum alone.
+        QStringList fields = reply.split(' ', QString::SkipEmptyParts);
+        int field = command == "HASH" ? 2 : 0;
+        if (field < fields.count()) {
+            QString hex = fields.at(field).toLower();
+            if (algorithm == FileHasher::Crc32)
+                hex = hex.rightJustified(8, '0');
+            bool ok = !hex.isEmpty();
+            for (int i = 0; ok && i < hex.size(); ++i)
+                ok = QString("0123456789abcdef").contains(hex.at(i));
+            if (ok)
+                check.remote = hex.toLatin1();
+        }
+    } else {
+        qWarning() << "ChecksumVerifier" << check.remotePath << ftp->errorString();
+    }
+    finish(transfer);
+    pump();
+}
+
+void ChecksumVerifier::hashed(const QString &path, int algorithm, const QByteArray &digest)
+{
+    if (algorithm != this->algorithm)
+        return;
+    QList<int> ready;
+    QHash<int, Check>::iterator i;
+    for (i = checks.begin(); i != checks.end(); ++i) {
+        if (!i->localDone && i->localPath == path) {
+            i->local = digest.toHex();
+            i->localDone = true;
+            ready.append(i.key());
+        }
+    }
+    foreach (int id, ready)
+        finish(id);
+}
+
+/*!
+    Reports the check of the transfer \a id once both checksums are in.
+ */
+void ChecksumVerifier::finish(int id)
+{
+    const Check &check = checks[id];
+    if (!check.remoteDone || !check.localDone)
+        return;
+    Result result = Unverified;
+    if (!check.remote.isEmpty() && !check.local.isEmpty())
+        result = check.remote == check.local ? Match : Mismatch;
+    checks.remove(id);
+    emit verified(id, result);
+}
+
+/*!
+    Reports every pending check as unverified.
+ */
+void ChecksumVerifier::giveUp()
+{
+    QList<int> ids = checks.keys();
+    checks.clear();
+    waiting.clear();
+    running.clear();
+    preparing.clear();
+    foreach (int id, ids)
+        emit verified(id, Unverified);
+}
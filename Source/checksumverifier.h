@@ -0,0 +1,74 @@
+#ifndef CHECKSUMVERIFIER_H
+#define CHECKSUMVERIFIER_H
+
+#include <qobject.h>
+#include <qhash.h>
+#include <qlist.h>
+#include <qmap.h>
+#include <qurl.h>
+
+#include "ftpengine.h"
+#include "filehasher.h"
+
+class ChecksumVerifier : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Result { Match, Mismatch, Unverified };
+
+    ChecksumVerifier(FileHasher *hasher, QObject *parent = 0);
+    ~ChecksumVerifier();
+
+    void setUrl(const QUrl &url);
+
+    void prepare(const QString &localPath);
+    void verify(int id, const QString &localPath, const QString &remotePath);
+
+public slots:
+    void abort();
+
+signals:
+    void verified(int id, int result);
+
+private slots:
+    void stateChanged(int state);
+    void commandStarted(int id);
+    void rawCommandReply(int code, const QString &detail);
+    void commandFinished(int id, bool error);
+    void hashed(const QString &path, int algorithm, const QByteArray &digest);
+
+private:
+    struct Check {
+        Check() : remoteDone(false), localDone(false) {}
+        QString localPath;
+        QString remotePath;
+        QByteArray remote;      // hex, lower case
+        QByteArray local;
+        bool remoteDone;
+        bool localDone;
+    };
+
+    FileHasher *hasher;
+    FtpEngine *ftp;
+    QUrl ftpUrl;
+    bool loggingIn;
+    bool chosen;
+    FileHasher::Algorithm algorithm;
+    QString command;            // empty if the server offers none we compute
+    int selecting;              // OPTS HASH running
+
+    QStringList preparing;
+    QHash<int, Check> checks;
+    QList<int> waiting;
+    QMap<int, int> running;     // command id to transfer id
+    int current;
+    QString reply;
+
+    void pump();
+    void choose();
+    void finish(int id);
+    void giveUp();
+};
+
+#endif // CHECKSUMVERIFIER_H
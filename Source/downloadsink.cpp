@@ -0,0 +1,403 @@
+#include "downloadsink.h"
+
+#include <qthread.h>
+#include <qmutex.h>
+#include <qwaitcondition.h>
+#include <qqueue.h>
+#include <qfile.h>
+#include <qdebug.h>
+
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Size of the buffers incoming data is collected in.
+static const qint64 BufferSize = 4 * 1024 * 1024;
+// Buffer address, file offset and length needed for O_DIRECT.
+static const qint64 Alignment = 4096;
+// Buffers one sink may have waiting for the disk before it blocks.
+static const int MaxPending = 4;
+// Free buffers kept around for the next download.
+static const int MaxPooled = 16;
+
+static QMutex poolMutex;
+static QList<char*> pooled;
+
+static char *takeBuffer()
+{
+    {
+        QMutexLocker locker(&poolMutex);
+        if (!pooled.isEmpty())
+            return pooled.takeLast();
+    }
+    return static_cast<char*>(qMallocAligned(BufferSize, Alignment));
+}
+
+static void giveBuffer(char *buffer)
+{
+    QMutexLocker locker(&poolMutex);
+    if (pooled.count() < MaxPooled)
+        pooled.append(buffer);
+    else
+        qFreeAligned(buffer);
+}
+
+/*!
+    Writes the buffers of one DownloadSink to disk in order, at their
+    offsets, on a thread of its own.
+ */
+class SinkWriter : public QThread
+{
+public:
+#ifdef Q_OS_UNIX
+    SinkWriter(int fd, int directFd)
+        : fd(fd), directFd(directFd), stopping(false), busy(false), written(0) {}
+#else
+    SinkWriter(QFile *file)
+        : file(file), stopping(false), busy(false), written(0) {}
+#endif
+
+    void enqueue(char *data, qint64 offset, qint64 length) {
+        QMutexLocker locker(&mutex);
+        while (chunks.count() >= MaxPending && lastError.isEmpty())
+            drained.wait(&mutex);
+        Chunk chunk = { data, offset, length };
+        chunks.enqueue(chunk);
+        queued.wakeOne();
+    }
+
+    // Returns once every buffer handed over so far is written.
+    void drain() {
+        QMutexLocker locker(&mutex);
+        while ((!chunks.isEmpty() || busy) && lastError.isEmpty())
+            drained.wait(&mutex);
+    }
+
+    void stop() {
+        {
+            QMutexLocker locker(&mutex);
+            stopping = true;
+            queued.wakeOne();
+        }
+        wait();
+    }
+
+    qint64 committed() const {
+        QMutexLocker locker(&mutex);
+        return written;
+    }
+
+    QString error() const {
+        QMutexLocker locker(&mutex);
+        return lastError;
+    }
+
+protected:
+    void run() {
+        forever {
+            Chunk chunk;
+            bool failed;
+            {
+                QMutexLocker locker(&mutex);
+                while (chunks.isEmpty() && !stopping)
+                    queued.wait(&mutex);
+                if (chunks.isEmpty())
+                    break;
+                chunk = chunks.dequeue();
+                failed = !lastError.isEmpty();
+                busy = true;
+            }
+            // After an error the rest is dropped.
+            QString failure = failed ? QString() : writeChunk(chunk);
+            giveBuffer(chunk.data);
+
+            QMutexLocker locker(&mutex);
+            busy = false;
+            if (!failure.isEmpty())
+                lastError = failure;
+            else if (!failed)
+                written += chunk.length;
+            drained.wakeAll();
+        }
+    }
+
+private:
+    struct Chunk {
+        char *data;
+        qint64 offset;
+        qint64 length;
+    };
+
+    QString writeChunk(const Chunk &chunk) {
+#ifdef Q_OS_UNIX
+        // Only whole, aligned blocks may bypass the page cache.
+        int target = (directFd >= 0 && chunk.offset % Alignment == 0
+                      && chunk.length % Alignment == 0) ? directFd : fd;
+        qint64 done = 0;
+        while (done < chunk.length) {
+            ssize_t n = ::pwrite(target, chunk.data + done, chunk.length - done,
+                                 chunk.offset + done);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n < 0 && target == directFd && errno == EINVAL) {
+                target = fd;
+                continue;
+            }
+            if (n <= 0)
+                return QString::fromLocal8Bit(strerror(n < 0 ? errno : ENOSPC));
+            done += n;
+        }
+        return QString();
+#else
+        if (!file->seek(chunk.offset) || file->write(chunk.data, chunk.length) != chunk.length)
+            return file->errorString();
+        return QString();
+#endif
+    }
+
+#ifdef Q_OS_UNIX
+    int fd;
+    int directFd;
+#else
+    QFile *file;
+#endif
+    mutable QMutex mutex;
+    QWaitCondition queued;
+    QWaitCondition drained;
+    QQueue<Chunk> chunks;
+    bool stopping;
+    bool busy;
+    qint64 written;
+    QString lastError;
+};
+
+/*!
+    \class DownloadSink downloadsink.h
+
+    \brief The DownloadSink class writes a download into a local file,
+    starting at a given offset, without making the network wait for the
+    disk.
+
+    Incoming data is collected in large buffers taken from a pool shared
+    by all sinks. Full buffers are written by a thread of their own with
+    pwrite(), so writeData() only copies into memory and blocks only if
+    the disk falls behind by several buffers. flush() waits until
+    everything handed over is written; bytesCommitted() tells how much of
+    it already is.
+
+    A sink with a \a length stores one byte range of a segmented download
+    and swallows data past its end, so the transfer can be aborted once
+    isComplete() returns true. An open ended sink cuts the file at its
+    offset, dropping whatever an interrupted attempt left behind, and
+    reserves setExpectedSize() bytes on disk with fallocate() where the
+    file system supports it.
+
+    With setDirectIo() whole aligned buffers are written with O_DIRECT,
+    keeping huge downloads out of the page cache.
+
+    \sa TransferPool
+*/
+
+DownloadSink::DownloadSink(const QString &path, qint64 offset, qint64 length)
+    : path(path), offset(offset), length(length), expected(-1), written(0),
+    direct(false), buffer(0), bufferStart(0), bufferUsed(0), bufferSize(0), writer(0)
+#ifdef Q_OS_UNIX
+    , fd(-1), directFd(-1)
+#else
+    , file(0)
+#endif
+{
+}
+
+DownloadSink::~DownloadSink()
+{
+    if (isOpen())
+        close();
+}
+
+/*!
+    Sets the size the whole file will have to \a size, -1 if unknown.
+ */
+void DownloadSink::setExpectedSize(qint64 size)
+{
+    expected = size;
+}
+
+/*!
+    Writes whole aligned buffers bypassing the page cache if \a enabled
+    is true and the platform supports it.
+ */
+void DownloadSink::setDirectIo(bool enabled)
+{
+    direct = enabled;
+}
+
+bool DownloadSink::open(OpenMode mode)
+{
+    if (!(mode & QIODevice::WriteOnly))
+        return false;
+#ifdef Q_OS_UNIX
+    QByteArray name = QFile::encodeName(path);
+    fd = ::open(name.constData(), O_WRONLY | O_CREAT, 0666);
+    if (fd < 0) {
+        setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        return false;
+    }
+    if (length < 0 && ::ftruncate(fd, offset) != 0) {
+        setErrorString(QString::fromLocal8Bit(strerror(errno)));
+        ::close(fd);
+        fd = -1;
+        return false;
+    }
+#if defined(Q_OS_LINUX) && defined(FALLOC_FL_KEEP_SIZE)
+    if (length < 0 && expected > offset)
+        ::fallocate(fd, FALLOC_FL_KEEP_SIZE, offset, expected - offset);
+#endif
+#ifdef O_DIRECT
+    if (direct)
+        directFd = ::open(name.constData(), O_WRONLY | O_DIRECT);
+#endif
+    writer = new SinkWriter(fd, directFd);
+#else
+    file = new QFile(path);
+    if (!file->open(QIODevice::ReadWrite)
+        || (length < 0 && !file->resize(offset))) {
+        setErrorString(file->errorString());
+        delete file;
+        file = 0;
+        return false;
+    }
+    writer = new SinkWriter(file);
+#endif
+    writer->start();
+    return QIODevice::open(mode);
+}
+
+void DownloadSink::close()
+{
+    if (!writer) {
+        QIODevice::close();
+        return;
+    }
+    submit();
+    writer->stop();
+    delete writer;
+    writer = 0;
+#ifdef Q_OS_UNIX
+    if (directFd >= 0)
+        ::close(directFd);
+    ::close(fd);
+    fd = directFd = -1;
+#else
+    delete file;
+    file = 0;
+#endif
+    QIODevice::close();
+}
+
+bool DownloadSink::isSequential() const
+{
+    return true;
+}
+
+/*!
+    Hands the current buffer over and waits until all data is written.
+    Returns false if writing failed.
+ */
+bool DownloadSink::flush()
+{
+    if (!writer)
+        return false;
+    submit();
+    writer->drain();
+    QString error = writer->error();
+    if (!error.isEmpty()) {
+        setErrorString(error);
+        return false;
+    }
+    return true;
+}
+
+/*!
+    Returns the number of bytes already written to the file, always a
+    prefix of bytesWritten().
+ */
+qint64 DownloadSink::bytesCommitted() const
+{
+    return writer ? writer->committed() : 0;
+}
+
+/*!
+    Creates the file at \a path with \a size bytes reserved on disk, or
+    at least with that size where space cannot be reserved.
+ */
+bool DownloadSink::preallocate(const QString &path, qint64 size)
+{
+#ifdef Q_OS_LINUX
+    int fd = ::open(QFile::encodeName(path).constData(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd >= 0) {
+        bool ok = ::fallocate(fd, 0, 0, size) == 0 || ::ftruncate(fd, size) == 0;
+        ::close(fd);
+        if (ok)
+            return true;
+    }
+#endif
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || !file.resize(size)) {
+        qWarning() << "DownloadSink" << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+qint64 DownloadSink::readData(char *, qint64)
+{
+    return -1;
+}
+
+qint64 DownloadSink::writeData(const char *data, qint64 len)
+{
+    QString error = writer->error();
+    if (!error.isEmpty()) {
+        setErrorString(error);
+        return -1;
+    }
+
+    qint64 left = (length < 0) ? len : qMax(qMin(len, length - written), qint64(0));
+    while (left > 0) {
+        if (!buffer) {
+            buffer = takeBuffer();
+            bufferStart = offset + written;
+            bufferUsed = 0;
+            // The first buffer ends on a block boundary, so the ones after
+            // it can go out with O_DIRECT.
+            bufferSize = BufferSize - bufferStart % Alignment;
+        }
+        qint64 n = qMin(left, bufferSize - bufferUsed);
+        memcpy(buffer + bufferUsed, data, n);
+        bufferUsed += n;
+        data += n;
+        left -= n;
+        written += n;
+        if (bufferUsed == bufferSize)
+            submit();
+    }
+    if (isComplete())
+        submit();
+    return len;
+}
+
+void DownloadSink::submit()
+{
+    if (!buffer)
+        return;
+    if (bufferUsed)
+        writer->enqueue(buffer, bufferStart, bufferUsed);
+    else
+        giveBuffer(buffer);
+    buffer = 0;
+}
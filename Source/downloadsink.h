@@ -0,0 +1,57 @@
+#ifndef DOWNLOADSINK_H
+#define DOWNLOADSINK_H
+
+#include <qiodevice.h>
+#include <qstring.h>
+
+class QFile;
+class SinkWriter;
+
+class DownloadSink : public QIODevice
+{
+public:
+    DownloadSink(const QString &path, qint64 offset, qint64 length = -1);
+    ~DownloadSink();
+
+    void setExpectedSize(qint64 size);
+    void setDirectIo(bool enabled);
+
+    bool open(OpenMode mode);
+    void close();
+    bool isSequential() const;
+    bool flush();
+
+    inline qint64 bytesWritten() const { return written; }
+    qint64 bytesCommitted() const;
+    inline bool isComplete() const { return length >= 0 && written >= length; }
+
+    static bool preallocate(const QString &path, qint64 size);
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 len);
+
+private:
+    QString path;
+    qint64 offset;
+    qint64 length;
+    qint64 expected;
+    qint64 written;
+    bool direct;
+
+    char *buffer;
+    qint64 bufferStart;
+    qint64 bufferUsed;
+    qint64 bufferSize;
+    SinkWriter *writer;
+#ifdef Q_OS_UNIX
+    int fd;
+    int directFd;
+#else
+    QFile *file;
+#endif
+
+    void submit();
+};
+
+#endif // DOWNLOADSINK_H
@@ -0,0 +1,273 @@
+#include "filehasher.h"
+
+#include <qrunnable.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <qdatetime.h>
+#include <qcryptographichash.h>
+#include <qmetaobject.h>
+#include <qthread.h>
+#include <qdatastream.h>
+#include <qdir.h>
+#include <qdebug.h>
+
+static const quint32 CacheMagic = 0x46544831; // "FTH1"
+
+// Checksums kept at most, beyond that arbitrary ones are forgotten.
+static const int MaxEntries = 100000;
+
+// Bytes read from the file at once.
+static const qint64 ChunkSize = 1024 * 1024;
+
+// CRC-32 (IEEE 802.3) lookup tables for eight bytes at a time.
+static quint32 crcTable[8][256];
+
+static bool initCrcTable()
+{
+    for (quint32 i = 0; i < 256; ++i) {
+        quint32 c = i;
+        for (int k = 0; k < 8; ++k)
+            c = (c & 1) ? (c >> 1) ^ 0xEDB88320u : c >> 1;
+        crcTable[0][i] = c;
+    }
+    for (int i = 0; i < 256; ++i) {
+        for (int k = 1; k < 8; ++k)
+            crcTable[k][i] = (crcTable[k - 1][i] >> 8) ^ crcTable[0][crcTable[k - 1][i] & 0xff];
+    }
+    return true;
+}
+
+class HashTask : public QRunnable
+{
+public:
+    HashTask(FileHasher *hasher, const QString &path, FileHasher::Algorithm algorithm)
+        : hasher(hasher), path(path), algorithm(algorithm) {}
+
+    void run()
+    {
+        QFileInfo info(path);
+        qint64 size = info.size();
+        uint modified = info.lastModified().toTime_t();
+        QByteArray digest;
+
+        QFile file(path);
+        if (file.open(QIODevice::ReadOnly)) {
+            QCryptographicHash hash(algorithm == FileHasher::Md5
+                                    ? QCryptographicHash::Md5 : QCryptographicHash::Sha1);
+            quint32 crc = 0;
+            QByteArray chunk;
+            chunk.resize(ChunkSize);
+            bool ok = true;
+            for (;;) {
+                qint64 read = file.read(chunk.data(), ChunkSize);
+                if (read < 0)
+                    ok = false;
+                if (read <= 0)
+                    break;
+                if (algorithm == FileHasher::Crc32)
+                    crc = FileHasher::crc32(crc, chunk.constData(), read);
+                else
+                    hash.addData(chunk.constData(), read);
+            }
+            if (ok && algorithm == FileHasher::Crc32) {
+                digest.resize(4);
+                digest[0] = char(crc >> 24);
+                digest[1] = char(crc >> 16);
+                digest[2] = char(crc >> 8);
+                digest[3] = char(crc);
+            } else if (ok) {
+                digest = hash.result();
+            }
+        }
+        QMetaObject::invokeMethod(hasher, "finished", Qt::QueuedConnection,
+                                  Q_ARG(QString, path), Q_ARG(int, algorithm),
+                                  Q_ARG(qint64, size), Q_ARG(uint, modified),
+                                  Q_ARG(QByteArray, digest));
+    }
+
+private:
+    FileHasher *hasher;
+    QString path;
+    FileHasher::Algorithm algorithm;
+};
+
+/*!
+    \class FileHasher filehasher.h
+
+    \brief The FileHasher class computes checksums of local files on a
+    pool of threads.
+
+    hash() returns at once and hashed() reports the digest later, so
+    files are hashed while they are transferred. A file is read once per
+    algorithm as long as its size and modification time stay the same.
+    CRC-32 is computed eight bytes at a time from lookup tables, MD5 and
+    SHA-1 by QCryptographicHash.
+
+    The checksums are kept on disk keyed by path, size and modification
+    time, so files which did not change are not read again in later
+    sessions either. Changes are written at most once a second and the
+    file is replaced atomically.
+
+    \sa ChecksumVerifier
+*/
+
+FileHasher::FileHasher(const QString &fileName, QObject *parent)
+    : QObject(parent), fileName(fileName)
+{
+    qRegisterMetaType<qint64>("qint64");
+    threads.setMaxThreadCount(QThread::idealThreadCount());
+    syncTimer.setSingleShot(true);
+    syncTimer.setInterval(1000);
+    connect(&syncTimer, SIGNAL(timeout()), this, SLOT(sync()));
+    load();
+}
+
+FileHasher::~FileHasher()
+{
+    threads.waitForDone();
+    if (syncTimer.isActive())
+        sync();
+}
+
+/*!
+    Returns the name of \a algorithm as servers use it in HASH.
+ */
+QString FileHasher::algorithmName(Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Crc32: return "CRC32";
+    case Md5: return "MD5";
+    default: return "SHA-1";
+    }
+}
+
+/*!
+    Returns the CRC-32 \a crc continued over \a size bytes at \a data.
+ */
+quint32 FileHasher::crc32(quint32 crc, const char *data, qint64 size)
+{
+    static const bool ready = initCrcTable();
+    Q_UNUSED(ready);
+    const uchar *p = reinterpret_cast<const uchar*>(data);
+    crc = ~crc;
+    while (size >= 8) {
+        quint32 one = crc ^ (p[0] | p[1] << 8 | p[2] << 16 | quint32(p[3]) << 24);
+        quint32 two = p[4] | p[5] << 8 | p[6] << 16 | quint32(p[7]) << 24;
+        crc = crcTable[7][one & 0xff] ^ crcTable[6][(one >> 8) & 0xff]
+            ^ crcTable[5][(one >> 16) & 0xff] ^ crcTable[4][one >> 24]
+            ^ crcTable[3][two & 0xff] ^ crcTable[2][(two >> 8) & 0xff]
+            ^ crcTable[1][(two >> 16) & 0xff] ^ crcTable[0][two >> 24];
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0)
+        crc = (crc >> 8) ^ crcTable[0][(crc ^ *p++) & 0xff];
+    return ~crc;
+}
+
+/*!
+    Sets \a digest to the checksum of \a path with \a algorithm and
+    returns true if it is known for the file as it is now.
+ */
+bool FileHasher::digest(const QString &path, Algorithm algorithm, QByteArray *digest) const
+{
+    QHash<QString, Entry>::const_iterator i = entries.constFind(key(path, algorithm));
+    if (i == entries.constEnd())
+        return false;
+    QFileInfo info(path);
+    if (info.size() != i->size || info.lastModified().toTime_t() != i->modified)
+        return false;
+    *digest = i->digest;
+    return true;
+}
+
+/*!
+    Computes the checksum of \a path with \a algorithm and reports it by
+    hashed(), with an empty digest if the file cannot be read.
+ */
+void FileHasher::hash(const QString &path, Algorithm algorithm)
+{
+    QString k = key(path, algorithm);
+    if (running.contains(k))
+        return;
+    QByteArray known;
+    if (digest(path, algorithm, &known)) {
+        QFileInfo info(path);
+        QMetaObject::invokeMethod(this, "finished", Qt::QueuedConnection,
+                                  Q_ARG(QString, path), Q_ARG(int, algorithm),
+                                  Q_ARG(qint64, info.size()),
+                                  Q_ARG(uint, info.lastModified().toTime_t()),
+                                  Q_ARG(QByteArray, known));
+    } else {
+        threads.start(new HashTask(this, path, algorithm));
+    }
+    running.insert(k);
+}
+
+void FileHasher::finished(const QString &path, int algorithm, qint64 size, uint modified,
+                          const QByteArray &digest)
+{
+    QString k = key(path, algorithm);
+    running.remove(k);
+    if (!digest.isEmpty()) {
+        Entry entry = { size, modified, digest };
+        entries.insert(k, entry);
+        while (entries.count() > MaxEntries)
+            entries.erase(entries.begin());
+        if (!syncTimer.isActive())
+            syncTimer.start();
+    }
+    emit hashed(path, algorithm, digest);
+}
+
+/*!
+    Writes the known checksums to disk.
+ */
+void FileHasher::sync()
+{
+    syncTimer.stop();
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    QFile out(fileName + ".new");
+    if (!out.open(QIODevice::WriteOnly)) {
+        qWarning() << "FileHasher" << out.errorString();
+        return;
+    }
+    QDataStream stream(&out);
+    stream << CacheMagic << quint32(entries.count());
+    for (QHash<QString, Entry>::const_iterator it = entries.constBegin();
+         it != entries.constEnd(); ++it)
+        stream << it.key() << it->size << quint32(it->modified) << it->digest;
+    out.close();
+
+    QFile::remove(fileName);
+    if (!QFile::rename(out.fileName(), fileName))
+        qWarning() << "FileHasher" << "cannot replace" << fileName;
+}
+
+void FileHasher::load()
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QDataStream in(&file);
+    quint32 magic, count;
+    in >> magic >> count;
+    if (magic != CacheMagic)
+        return;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString k;
+        Entry entry;
+        quint32 modified;
+        in >> k >> entry.size >> modified >> entry.digest;
+        entry.modified = modified;
+        if (in.status() == QDataStream::Ok)
+            entries.insert(k, entry);
+    }
+    qDebug() << "checksums loaded  :" << entries.count();
+}
+
+QString FileHasher::key(const QString &path, int algorithm)
+{
+    return QString::number(algorithm) + ':' + path;
+}
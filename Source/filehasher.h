@@ -0,0 +1,53 @@
+#ifndef FILEHASHER_H
+#define FILEHASHER_H
+
+#include <qobject.h>
+#include <qhash.h>
+#include <qset.h>
+#include <qthreadpool.h>
+#include <qtimer.h>
+
+class FileHasher : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Algorithm { Crc32, Md5, Sha1 };
+
+    FileHasher(const QString &fileName, QObject *parent = 0);
+    ~FileHasher();
+
+    static QString algorithmName(Algorithm algorithm);
+    static quint32 crc32(quint32 crc, const char *data, qint64 size);
+
+    bool digest(const QString &path, Algorithm algorithm, QByteArray *digest) const;
+    void hash(const QString &path, Algorithm algorithm);
+
+public slots:
+    void sync();
+
+signals:
+    void hashed(const QString &path, int algorithm, const QByteArray &digest);
+
+private slots:
+    void finished(const QString &path, int algorithm, qint64 size, uint modified,
+                  const QByteArray &digest);
+
+private:
+    struct Entry {
+        qint64 size;
+        uint modified;
+        QByteArray digest;
+    };
+
+    QString fileName;
+    QThreadPool threads;
+    QHash<QString, Entry> entries;
+    QSet<QString> running;
+    QTimer syncTimer;
+
+    static QString key(const QString &path, int algorithm);
+    void load();
+};
+
+#endif // FILEHASHER_H
@@ -7,15 +7,43 @@
 QT       += core gui
 QT       += network
 
+LIBS     += -lz
+
 TARGET = ftpclient
 TEMPLATE = app
 
 
 SOURCES += main.cpp\
         window.cpp \
-    ftpmodel.cpp
+    ftpmodel.cpp \
+    transferpool.cpp \
+    transferjournal.cpp \
+    transferqueue.cpp \
+    sessionkeeper.cpp \
+    ftpengine.cpp \
+    ftpworker.cpp \
+    downloadsink.cpp \
+    ftpitem.cpp \
+    listingcache.cpp \
+    listingprefetcher.cpp \
+    treewalker.cpp \
+    filehasher.cpp \
+    checksumverifier.cpp
 
 HEADERS  += window.h \
-    ftpmodel.h
+    ftpmodel.h \
+    transferpool.h \
+    transferjournal.h \
+    transferqueue.h \
+    sessionkeeper.h \
+    ftpengine.h \
+    ftpworker.h \
+    downloadsink.h \
+    ftpitem.h \
+    listingcache.h \
+    listingprefetcher.h \
+    treewalker.h \
+    filehasher.h \
+    checksumverifier.h
 
 FORMS    += window.ui
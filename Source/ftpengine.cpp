@@ -0,0 +1,576 @@
+#include "ftpengine.h"
+
+#include <qfileinfo.h>
+#include <qdebug.h>
+
+/*!
+    \class FtpEngine ftpengine.h
+
+    \brief The FtpEngine class is an asynchronous ftp client built
+    directly on QTcpSocket.
+
+    FtpEngine offers the interface of QFtp, including its signals and
+    its QFtp::State, QFtp::Command and QFtp::Error values, so it can be
+    used in place of QFtp. Every call queues an operation and returns its
+    id; operations run in order and each is reported by commandStarted()
+    and commandFinished(). As with QFtp, an error clears the operations
+    still pending.
+
+    The sockets, and the devices given to get() and put(), are driven by
+    an FtpWorker on a thread of the engine's own, so neither a busy user
+    interface nor a slow disk holds up the other. Its results arrive as
+    queued signals: progress at most every 100 ms and listings in batches
+    through listInfos(), tagged with the id of their operation.
+
+    Unlike QFtp the control channel is driven by an explicit reply parser
+    and every operation is broken into protocol steps. Steps which do not
+    depend on the outcome of the steps before them, such as TYPE, SIZE,
+    MDTM, CWD, MKD, DELE or PASV, are sent without waiting for earlier
+    replies, up to pipelineDepth() at a time, also across operations.
+    commandStarted() still follows the commandFinished() of the operation
+    before, as with QFtp.
+    Replies are matched to steps in order, as RFC 959 guarantees. Login,
+    raw commands and the transfer commands themselves wait for all
+    earlier replies.
+
+    While a file streams, the PASV of the next queued transfer is sent
+    ahead and its data connection opened, so the next transfer starts
+    without waiting for either. With prenegotiation() enabled this is
+    done even before the next transfer is queued, which lets a caller
+    that only queues one transfer at a time run back to back.
+
+    On Linux, uploads from a QFile are passed to the kernel with
+    sendfile(), or sent from mmap'd windows of the file where sendfile()
+    is not supported, instead of being copied through QTcpSocket's
+    buffers; see zeroCopy().
+
+    After logging in the server is asked for its extensions with FEAT;
+    see features(). Where it supports MLST, directories are listed with
+    MLSD, whose machine readable facts are parsed in place instead of
+    guessing at the format of LIST.
+
+    With a compressionLevel() set, files are transferred in MODE Z where
+    the server announces it: the worker deflates uploads and inflates
+    downloads as they stream, so REST offsets and lengths still count
+    the bytes of the file. Files whose suffix is one of
+    uncompressedTypes() are sent as they are.
+
+    \sa QFtp
+*/
+
+FtpEngine::FtpEngine(QObject *parent)
+    : QObject(parent), current(0), lastId(0), anyError(false),
+    currentState(QFtp::Unconnected), lastError(QFtp::NoError), lastReply(0),
+    depth(8), prepare(false), direct(true), level(0)
+{
+    skipTypes << "7z" << "avi" << "bz2" << "cab" << "deb" << "docx" << "flac" << "gif"
+              << "gz" << "jar" << "jpeg" << "jpg" << "lz" << "lzma" << "mkv" << "mov"
+              << "mp3" << "mp4" << "odt" << "ogg" << "png" << "rar" << "rpm" << "tgz"
+              << "webm" << "webp" << "xlsx" << "xz" << "zip" << "zst";
+    qRegisterMetaType<FtpListing>("FtpListing");
+
+    worker = new FtpWorker;
+    worker->moveToThread(&thread);
+    connect(&thread, SIGNAL(finished()), worker, SLOT(shutdown()), Qt::DirectConnection);
+    connect(worker, SIGNAL(stateChanged(int)), this, SLOT(workerStateChanged(int)));
+    connect(worker, SIGNAL(featuresChanged(QStringList)),
+            this, SLOT(workerFeaturesChanged(QStringList)));
+    connect(worker, SIGNAL(listInfos(int,FtpListing)), this, SLOT(workerListInfos(int,FtpListing)));
+    connect(worker, SIGNAL(dataTransferProgress(qint64,qint64)),
+            this, SIGNAL(dataTransferProgress(qint64,qint64)));
+    connect(worker, SIGNAL(rawCommandReply(int,QString)), this, SIGNAL(rawCommandReply(int,QString)));
+    connect(worker, SIGNAL(commandStarted(int)), this, SLOT(workerCommandStarted(int)));
+    connect(worker, SIGNAL(commandFinished(int,bool,int,int,QString,int)),
+            this, SLOT(workerCommandFinished(int,bool,int,int,QString,int)));
+    thread.start();
+}
+
+FtpEngine::~FtpEngine()
+{
+    // The worker closes its sockets as its thread finishes.
+    thread.quit();
+    thread.wait();
+    delete worker;
+}
+
+/*!
+    Connects to the ftp server \a host at \a port.
+ */
+int FtpEngine::connectToHost(const QString &host, quint16 port)
+{
+    FtpWorker::Operation *op = operation(QFtp::ConnectToHost);
+    op->host = host;
+    op->port = port;
+    FtpWorker::step(op, FtpWorker::Connect);
+    return post(op);
+}
+
+/*!
+    Logs in as \a user with \a password, anonymously if no user is given,
+    and learns which extensions the server supports.
+ */
+int FtpEngine::login(const QString &user, const QString &password)
+{
+    FtpWorker::Operation *op = operation(QFtp::Login);
+    FtpWorker::step(op, FtpWorker::User,
+                    "USER " + (user.isEmpty() ? QByteArray("anonymous") : user.toUtf8()));
+    FtpWorker::step(op, FtpWorker::Barrier,
+                    "PASS " + (user.isEmpty() && password.isEmpty()
+                               ? QByteArray("anonymous@") : password.toUtf8()));
+    FtpWorker::step(op, FtpWorker::Barrier, "FEAT")->optional = true;
+    return post(op);
+}
+
+/*!
+    Closes the connection to the server.
+ */
+int FtpEngine::close()
+{
+    FtpWorker::Operation *op = operation(QFtp::Close);
+    FtpWorker::step(op, FtpWorker::Quit, "QUIT");
+    return post(op);
+}
+
+/*!
+    Lists the contents of \a dir. The entries are reported by listInfo()
+    and, in batches, by listInfos().
+ */
+int FtpEngine::list(const QString &dir)
+{
+    FtpWorker::Operation *op = operation(QFtp::List);
+    FtpWorker::step(op, FtpWorker::Plain, "TYPE A");
+    FtpWorker::step(op, FtpWorker::Passive, "PASV");
+    FtpWorker::step(op, FtpWorker::Transfer,
+                    dir.isEmpty() ? QByteArray("LIST") : "LIST " + FtpWorker::encodePath(dir));
+    return post(op);
+}
+
+/*!
+    Asks for the facts of the single file or directory \a path with MLST.
+    The entry is reported by listInfo() and listInfos(), named by the
+    path the server gives. Requires the MLST feature.
+ */
+int FtpEngine::stat(const QString &path)
+{
+    FtpWorker::Operation *op = operation(QFtp::List);
+    FtpWorker::step(op, FtpWorker::Plain, "MLST " + FtpWorker::encodePath(path));
+    return post(op);
+}
+
+/*!
+    Asks for the size of \a file with SIZE, in binary mode, as the size
+    in ASCII mode may differ or be refused. The size is reported by
+    rawCommandReply() with the code 213.
+ */
+int FtpEngine::size(const QString &file)
+{
+    FtpWorker::Operation *op = operation(QFtp::RawCommand);
+    FtpWorker::step(op, FtpWorker::Plain, "TYPE I");
+    FtpWorker::step(op, FtpWorker::Plain, "SIZE " + FtpWorker::encodePath(file));
+    return post(op);
+}
+
+/*!
+    Creates the directory \a dir like mkdir(), but a refused MKD, most
+    often because \a dir exists already, does not fail the operation.
+    The operations queued behind it are kept and run on.
+ */
+int FtpEngine::ensureDir(const QString &dir)
+{
+    FtpWorker::Operation *op = operation(QFtp::Mkdir);
+    FtpWorker::step(op, FtpWorker::Plain, "MKD " + FtpWorker::encodePath(dir))->optional = true;
+    return post(op);
+}
+
+int FtpEngine::cd(const QString &dir)
+{
+    FtpWorker::Operation *op = operation(QFtp::Cd);
+    FtpWorker::step(op, FtpWorker::Plain, "CWD " + FtpWorker::encodePath(dir));
+    return post(op);
+}
+
+/*!
+    Downloads \a file into \a dev, which has to be open for writing.
+ */
+int FtpEngine::get(const QString &file, QIODevice *dev)
+{
+    return get(file, dev, 0);
+}
+
+/*!
+    \overload
+
+    Downloads \a file from \a offset on into \a dev. With a \a length
+    the transfer is stopped after as many bytes and still reported as
+    successful.
+ */
+int FtpEngine::get(const QString &file, QIODevice *dev, qint64 offset, qint64 length)
+{
+    FtpWorker::Operation *op = operation(QFtp::Get);
+    op->device = dev;
+    op->offset = offset;
+    op->length = length;
+    FtpWorker::step(op, FtpWorker::Plain, "TYPE I");
+    FtpWorker::step(op, FtpWorker::Passive, "PASV");
+    FtpWorker::step(op, FtpWorker::Plain, "SIZE " + FtpWorker::encodePath(file))->optional = true;
+    bool deflate = compresses(file);
+    if (deflate)
+        addModeSteps(op, true);
+    if (offset > 0)
+        FtpWorker::step(op, FtpWorker::Plain, "REST " + QByteArray::number(offset));
+    FtpWorker::step(op, FtpWorker::Transfer, "RETR " + FtpWorker::encodePath(file));
+    if (deflate)
+        addModeSteps(op, false);
+    return post(op);
+}
+
+/*!
+    Uploads the contents of \a dev, which has to be open for reading, as
+    \a file.
+ */
+int FtpEngine::put(QIODevice *dev, const QString &file)
+{
+    return put(dev, file, 0);
+}
+
+/*!
+    \overload
+
+    Uploads \a dev, positioned at \a offset, into \a file from \a offset on.
+ */
+int FtpEngine::put(QIODevice *dev, const QString &file, qint64 offset)
+{
+    FtpWorker::Operation *op = operation(QFtp::Put);
+    op->device = dev;
+    op->offset = offset;
+    op->total = dev ? dev->size() : -1;
+    FtpWorker::step(op, FtpWorker::Plain, "TYPE I");
+    FtpWorker::step(op, FtpWorker::Passive, "PASV");
+    bool deflate = compresses(file);
+    if (deflate)
+        addModeSteps(op, true);
+    if (offset > 0)
+        FtpWorker::step(op, FtpWorker::Plain, "REST " + QByteArray::number(offset));
+    FtpWorker::step(op, FtpWorker::Transfer, "STOR " + FtpWorker::encodePath(file));
+    if (deflate)
+        addModeSteps(op, false);
+    return post(op);
+}
+
+int FtpEngine::remove(const QString &file)
+{
+    FtpWorker::Operation *op = operation(QFtp::Remove);
+    FtpWorker::step(op, FtpWorker::Plain, "DELE " + FtpWorker::encodePath(file));
+    return post(op);
+}
+
+int FtpEngine::mkdir(const QString &dir)
+{
+    FtpWorker::Operation *op = operation(QFtp::Mkdir);
+    FtpWorker::step(op, FtpWorker::Plain, "MKD " + FtpWorker::encodePath(dir));
+    return post(op);
+}
+
+int FtpEngine::rmdir(const QString &dir)
+{
+    FtpWorker::Operation *op = operation(QFtp::Rmdir);
+    FtpWorker::step(op, FtpWorker::Plain, "RMD " + FtpWorker::encodePath(dir));
+    return post(op);
+}
+
+int FtpEngine::rename(const QString &oldname, const QString &newname)
+{
+    FtpWorker::Operation *op = operation(QFtp::Rename);
+    FtpWorker::step(op, FtpWorker::Plain, "RNFR " + FtpWorker::encodePath(oldname));
+    FtpWorker::step(op, FtpWorker::Plain, "RNTO " + FtpWorker::encodePath(newname));
+    return post(op);
+}
+
+/*!
+    Sends \a command as is. The reply is reported by rawCommandReply().
+ */
+int FtpEngine::rawCommand(const QString &command)
+{
+    FtpWorker::Operation *op = operation(QFtp::RawCommand);
+    FtpWorker::step(op, FtpWorker::Barrier, command.trimmed().toUtf8());
+    return post(op);
+}
+
+/*!
+    Aborts the current operation and clears the pending ones. A running
+    transfer is stopped with ABOR. Returns once the worker has let go of
+    the devices of all operations, they may be deleted right away.
+ */
+void FtpEngine::abort()
+{
+    QMetaObject::invokeMethod(worker, "abort", Qt::BlockingQueuedConnection);
+}
+
+/*!
+    Drops the operations which have not been started yet.
+ */
+void FtpEngine::clearPendingCommands()
+{
+    QMetaObject::invokeMethod(worker, "clearPendingCommands", Qt::BlockingQueuedConnection);
+    QMap<int, QFtp::Command>::iterator it = pending.begin();
+    while (it != pending.end()) {
+        if (it.key() > current)
+            it = pending.erase(it);
+        else
+            ++it;
+    }
+}
+
+QFtp::State FtpEngine::state() const
+{
+    return currentState;
+}
+
+/*!
+    Returns the type of the operation running at the moment.
+ */
+QFtp::Command FtpEngine::currentCommand() const
+{
+    return current ? pending.value(current, QFtp::None) : QFtp::None;
+}
+
+int FtpEngine::currentId() const
+{
+    return current;
+}
+
+bool FtpEngine::hasPendingCommands() const
+{
+    return pending.count() > (pending.contains(current) ? 1 : 0);
+}
+
+/*!
+    Returns the extensions the server announced in its FEAT reply, such
+    as "MLST", "MDTM", "SIZE" or "HASH". Empty until logged in.
+ */
+QStringList FtpEngine::features() const
+{
+    return serverFeatures;
+}
+
+bool FtpEngine::hasFeature(const QString &feature) const
+{
+    return serverFeatures.contains(feature, Qt::CaseInsensitive);
+}
+
+/*!
+    Returns the parameters the server announced with \a feature, such as
+    "SHA-1*;MD5;CRC32" for "HASH".
+ */
+QString FtpEngine::featureParameters(const QString &feature) const
+{
+    return serverParameters.value(feature.toUpper());
+}
+
+QFtp::Error FtpEngine::error() const
+{
+    return lastError;
+}
+
+QString FtpEngine::errorString() const
+{
+    return lastErrorString;
+}
+
+/*!
+    Returns the code of the server reply which made the last operation
+    fail, such as 530 or 421, or 0 if it failed for another reason.
+ */
+int FtpEngine::replyCode() const
+{
+    return lastReply;
+}
+
+/*!
+    Returns how many steps may wait for their reply at the same time.
+ */
+int FtpEngine::pipelineDepth() const
+{
+    return depth;
+}
+
+void FtpEngine::setPipelineDepth(int depth)
+{
+    this->depth = qMax(1, depth);
+    QMetaObject::invokeMethod(worker, "setPipelineDepth", Qt::QueuedConnection,
+                              Q_ARG(int, this->depth));
+}
+
+/*!
+    Returns true if a data connection is negotiated during every
+    transfer for whichever transfer comes next.
+ */
+bool FtpEngine::prenegotiation() const
+{
+    return prepare;
+}
+
+void FtpEngine::setPrenegotiation(bool enabled)
+{
+    prepare = enabled;
+    QMetaObject::invokeMethod(worker, "setPrenegotiation", Qt::QueuedConnection,
+                              Q_ARG(bool, enabled));
+}
+
+/*!
+    Returns true if uploads from local files bypass the socket buffers
+    where the platform allows it. Enabled by default.
+
+    sendfile() cannot be told not to raise SIGPIPE, so the application
+    has to ignore the signal, as main() does.
+ */
+bool FtpEngine::zeroCopy() const
+{
+    return direct;
+}
+
+void FtpEngine::setZeroCopy(bool enabled)
+{
+    direct = enabled;
+    QMetaObject::invokeMethod(worker, "setZeroCopy", Qt::QueuedConnection,
+                              Q_ARG(bool, enabled));
+}
+
+/*!
+    Returns the zlib level, 1 to 9, of transfers in MODE Z, or 0 if
+    files are transferred as they are. 0 by default.
+ */
+int FtpEngine::compressionLevel() const
+{
+    return level;
+}
+
+void FtpEngine::setCompressionLevel(int level)
+{
+    this->level = qBound(0, level, 9);
+}
+
+/*!
+    Returns the file name suffixes, in lower case, of files which are
+    compressed already and so never transferred in MODE Z.
+ */
+QStringList FtpEngine::uncompressedTypes() const
+{
+    return skipTypes;
+}
+
+void FtpEngine::setUncompressedTypes(const QStringList &suffixes)
+{
+    skipTypes.clear();
+    foreach (const QString &suffix, suffixes)
+        skipTypes.append(suffix.toLower());
+}
+
+FtpWorker::Operation *FtpEngine::operation(QFtp::Command type)
+{
+    FtpWorker::Operation *op = new FtpWorker::Operation;
+    op->id = ++lastId;
+    op->type = type;
+    return op;
+}
+
+int FtpEngine::post(FtpWorker::Operation *op)
+{
+    pending.insert(op->id, op->type);
+    worker->post(op);
+    return op->id;
+}
+
+void FtpEngine::workerStateChanged(int state)
+{
+    currentState = QFtp::State(state);
+    emit stateChanged(state);
+}
+
+void FtpEngine::workerFeaturesChanged(const QStringList &features)
+{
+    serverFeatures.clear();
+    serverParameters.clear();
+    foreach (const QString &feature, features) {
+        QString name = feature.section(' ', 0, 0);
+        serverFeatures.append(name);
+        serverParameters.insert(name, feature.section(' ', 1));
+    }
+    emit featuresChanged();
+}
+
+void FtpEngine::workerListInfos(int id, const FtpListing &infos)
+{
+    emit listInfos(id, infos);
+    if (receivers(SIGNAL(listInfo(QUrlInfo))) > 0) {
+        foreach (const QUrlInfo &info, infos)
+            emit listInfo(info);
+    }
+}
+
+void FtpEngine::workerCommandStarted(int id)
+{
+    current = id;
+    emit commandStarted(id);
+}
+
+/*!
+    Mirrors the end of operation \a id. After an error the worker has
+    dropped all operations up to \a dropped, without a signal.
+ */
+void FtpEngine::workerCommandFinished(int id, bool error, int code, int reply, const QString &text,
+                                      int dropped)
+{
+    if (error) {
+        anyError = true;
+        lastError = QFtp::Error(code);
+        lastErrorString = text;
+        lastReply = reply;
+        QMap<int, QFtp::Command>::iterator it = pending.begin();
+        while (it != pending.end() && it.key() <= dropped)
+            it = pending.erase(it);
+    }
+    pending.remove(id);
+    if (current == id)
+        current = 0;
+    emit commandFinished(id, error);
+
+    if (pending.isEmpty()) {
+        bool hadError = anyError;
+        anyError = false;
+        emit done(hadError);
+    }
+}
+
+/*!
+    Returns true if \a file is to be transferred in MODE Z.
+ */
+bool FtpEngine::compresses(const QString &file) const
+{
+    return level > 0 && !skipTypes.contains(QFileInfo(file).suffix().toLower());
+}
+
+/*!
+    Adds the steps switching to MODE Z \a before the transfer of \a op,
+    or back to stream mode after it. The worker skips them where the
+    server does not announce MODE Z, and a refusal leaves the transfer
+    uncompressed.
+ */
+void FtpEngine::addModeSteps(FtpWorker::Operation *op, bool before)
+{
+    QList<QByteArray> lines;
+    if (before) {
+        op->level = level;
+        // Downloads are compressed by the server.
+        if (op->type == QFtp::Get)
+            lines << "OPTS MODE Z LEVEL " + QByteArray::number(level);
+        lines << "MODE Z";
+    } else {
+        lines << "MODE S";
+    }
+    foreach (const QByteArray &line, lines) {
+        FtpWorker::Step *s = FtpWorker::step(op, FtpWorker::Plain, line);
+        s->optional = true;
+        s->deflate = true;
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef FTPENGINE_H
+#define FTPENGINE_H
+
+#include <qobject.h>
+#include <qftp.h>
+#include <qurlinfo.h>
+#include <qmap.h>
+#include <qhash.h>
+#include <qthread.h>
+
+#include "ftpworker.h"
+
+class QIODevice;
+
+class FtpEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    FtpEngine(QObject *parent = 0);
+    ~FtpEngine();
+
+    // The QFtp interface
+    int connectToHost(const QString &host, quint16 port = 21);
+    int login(const QString &user = QString(), const QString &password = QString());
+    int close();
+    int list(const QString &dir = QString());
+    int cd(const QString &dir);
+    int get(const QString &file, QIODevice *dev = 0);
+    int put(QIODevice *dev, const QString &file);
+    int remove(const QString &file);
+    int mkdir(const QString &dir);
+    int rmdir(const QString &dir);
+    int rename(const QString &oldname, const QString &newname);
+    int rawCommand(const QString &command);
+
+    void abort();
+    void clearPendingCommands();
+
+    QFtp::State state() const;
+    QFtp::Command currentCommand() const;
+    int currentId() const;
+    bool hasPendingCommands() const;
+    QFtp::Error error() const;
+    QString errorString() const;
+
+    // Extensions
+    int get(const QString &file, QIODevice *dev, qint64 offset, qint64 length = -1);
+    int put(QIODevice *dev, const QString &file, qint64 offset);
+    int stat(const QString &path);
+    int size(const QString &file);
+    int ensureDir(const QString &dir);
+    int replyCode() const;
+
+    QStringList features() const;
+    bool hasFeature(const QString &feature) const;
+    QString featureParameters(const QString &feature) const;
+
+    int pipelineDepth() const;
+    void setPipelineDepth(int depth);
+    bool prenegotiation() const;
+    void setPrenegotiation(bool enabled);
+    bool zeroCopy() const;
+    void setZeroCopy(bool enabled);
+    int compressionLevel() const;
+    void setCompressionLevel(int level);
+    QStringList uncompressedTypes() const;
+    void setUncompressedTypes(const QStringList &suffixes);
+
+signals:
+    void stateChanged(int state);
+    void featuresChanged();
+    void listInfo(const QUrlInfo &info);
+    void listInfos(int id, const FtpListing &infos);
+    void dataTransferProgress(qint64 done, qint64 total);
+    void rawCommandReply(int replyCode, const QString &detail);
+    void commandStarted(int id);
+    void commandFinished(int id, bool error);
+    void done(bool error);
+
+private slots:
+    void workerStateChanged(int state);
+    void workerFeaturesChanged(const QStringList &features);
+    void workerListInfos(int id, const FtpListing &infos);
+    void workerCommandStarted(int id);
+    void workerCommandFinished(int id, bool error, int code, int reply, const QString &text,
+                               int dropped);
+
+private:
+    QThread thread;
+    FtpWorker *worker;
+
+    QMap<int, QFtp::Command> pending;
+    int current;
+    int lastId;
+    bool anyError;
+    QFtp::State currentState;
+    QFtp::Error lastError;
+    QString lastErrorString;
+    int lastReply;
+    QStringList serverFeatures;
+    QHash<QString, QString> serverParameters;
+    int depth;
+    bool prepare;
+    bool direct;
+    int level;
+    QStringList skipTypes;
+
+    FtpWorker::Operation *operation(QFtp::Command type);
+    int post(FtpWorker::Operation *op);
+    bool compresses(const QString &file) const;
+    void addModeSteps(FtpWorker::Operation *op, bool before);
+};
+
+#endif // FTPENGINE_H
@@ -0,0 +1,308 @@
+#include "ftpitem.h"
+
+#include <new>
+#include <string.h>
+
+// Nodes allocated at once.
+static const int BlockSize = 1024;
+// Children a directory needs before its names are hashed.
+static const int LookupThreshold = 32;
+// Bytes of names allocated at once.
+static const int NameBlockSize = 64 * 1024;
+// Bytes of names no node points at before they are compacted.
+static const qint64 NameWasteLimit = 1024 * 1024;
+
+static inline uint nameKey(const FtpItem *item)
+{
+    return qHash(QByteArray::fromRawData(item->nameData, item->nameSize));
+}
+
+/*!
+    \class FtpItem ftpitem.h
+
+    \brief The FtpItem class is a node of the remote tree of FtpModel.
+
+    A node never moves once created, so model indexes may point at it
+    while its directory grows. It knows its own row, which makes finding
+    the index of its parent cheap, and wide directories find a child by
+    name through a hash.
+
+    The metadata of a listing entry is kept compact: the name points into
+    the name blocks of the arena, owner and group are interned, the time
+    is a number and the flags are bits. Strings are only made when asked
+    for.
+
+    \sa FtpItemArena
+*/
+
+/*!
+    Appends \a child as the last row.
+ */
+void FtpItem::append(FtpItem *child)
+{
+    child->parent = this;
+    child->row = children.count();
+    children.append(child);
+    if (lookup)
+        lookup->insert(nameKey(child), child);
+}
+
+/*!
+    Takes \a count children from \a row on out of the directory. They
+    still have to be released.
+ */
+void FtpItem::removeChildren(int row, int count)
+{
+    if (lookup) {
+        for (int i = row; i < row + count; ++i)
+            lookup->remove(nameKey(children.at(i)), children.at(i));
+    }
+    children.remove(row, count);
+    shown -= qMax(0, qMin(shown, row + count) - row);
+    renumber(row);
+}
+
+/*!
+    Forgets all children, which still have to be released.
+ */
+void FtpItem::clearChildren()
+{
+    delete lookup;
+    lookup = 0;
+    children.clear();
+    shown = 0;
+}
+
+/*!
+    Tells the children from row \a from on where they are, after rows
+    were removed or moved.
+ */
+void FtpItem::renumber(int from)
+{
+    for (int i = from; i < children.count(); ++i)
+        children.at(i)->row = i;
+}
+
+/*!
+    Returns the first child called \a name, or 0 if there is none.
+ */
+FtpItem *FtpItem::child(const QString &name) const
+{
+    QByteArray utf8 = name.toUtf8();
+    if (!lookup && children.count() >= LookupThreshold) {
+        lookup = new QMultiHash<uint, FtpItem*>();
+        lookup->reserve(children.count());
+        foreach (FtpItem *item, children)
+            lookup->insert(nameKey(item), item);
+    }
+    if (lookup) {
+        // Names may repeat in broken listings, the first row wins.
+        FtpItem *found = 0;
+        uint key = qHash(utf8);
+        QMultiHash<uint, FtpItem*>::const_iterator it = lookup->constFind(key);
+        for (; it != lookup->constEnd() && it.key() == key; ++it)
+            if (it.value()->hasName(utf8) && (!found || it.value()->row < found->row))
+                found = it.value();
+        return found;
+    }
+    foreach (FtpItem *item, children)
+        if (item->hasName(utf8))
+            return item;
+    return 0;
+}
+
+/*!
+    \class FtpItemArena ftpitem.h
+
+    \brief The FtpItemArena class allocates the nodes of a remote tree.
+
+    Nodes are carved out of large blocks instead of being allocated one
+    by one, and released nodes are reused. The blocks are returned to the
+    system only when the arena is destroyed.
+
+    Names are copied into blocks of their own, which are dropped once the
+    last node is released. As long as the tree lives, refreshes release
+    nodes and copy names again; compact() moves the names still in use
+    into new blocks once most of the bytes are wasted. Owner and group
+    names are stored once.
+*/
+
+FtpItemArena::FtpItemArena() : used(BlockSize), live(0), nameUsed(0), nameCapacity(0),
+    nameAllocated(0), nameLive(0)
+{
+    // Id 0 stands for no name.
+    intern(QString());
+}
+
+/*!
+    Frees the blocks. Nodes still in use must have been released before.
+ */
+FtpItemArena::~FtpItemArena()
+{
+    foreach (FtpItem *block, blocks)
+        ::operator delete(block);
+    freeNames();
+}
+
+/*!
+    Returns a new node below \a parent, which it still has to be appended
+    to.
+ */
+FtpItem *FtpItemArena::create(FtpItem *parent)
+{
+    void *place;
+    if (!freeItems.isEmpty()) {
+        place = freeItems.last();
+        freeItems.pop_back();
+    } else {
+        if (used == BlockSize) {
+            blocks.append(static_cast<FtpItem*>(::operator new(BlockSize * sizeof(FtpItem))));
+            used = 0;
+        }
+        place = blocks.last() + used++;
+    }
+    FtpItem *item = new (place) FtpItem();
+    item->parent = parent;
+    ++live;
+    return item;
+}
+
+/*!
+    Releases \a item and everything below it.
+ */
+void FtpItemArena::release(FtpItem *item)
+{
+    if (!item)
+        return;
+    releaseChildren(item);
+    nameLive -= item->nameSize;
+    item->~FtpItem();
+    freeItems.append(item);
+    // Names of released nodes are not reused one by one, but by compact()
+    // or all at once when the tree is gone.
+    if (--live == 0)
+        freeNames();
+}
+
+/*!
+    Releases everything below \a item and leaves it without children.
+ */
+void FtpItemArena::releaseChildren(FtpItem *item)
+{
+    foreach (FtpItem *child, item->children)
+        release(child);
+    item->clearChildren();
+}
+
+/*!
+    Stores the listing entry \a info in \a item. An item keeps its name
+    if it does not change.
+ */
+void FtpItemArena::assign(FtpItem *item, const QUrlInfo &info)
+{
+    QByteArray name = info.name().toUtf8();
+    if (!item->nameData || !item->hasName(name)) {
+        nameLive -= item->nameSize;
+        setName(item, name.constData(), name.size());
+    }
+    item->owner = intern(info.owner());
+    item->group = intern(info.group());
+    item->modified = info.lastModified().isValid() ? info.lastModified().toTime_t() : 0;
+    item->size = info.size();
+    item->permissions = info.permissions();
+    item->dir = info.isDir();
+    item->file = info.isFile();
+    item->symLink = info.isSymLink();
+    item->readable = info.isReadable();
+    item->writable = info.isWritable();
+    item->executable = info.isExecutable();
+}
+
+/*!
+    Returns the listing entry stored in \a item.
+ */
+QUrlInfo FtpItemArena::urlInfo(const FtpItem *item) const
+{
+    QDateTime modified = item->lastModified();
+    return QUrlInfo(item->name(), item->permissions, string(item->owner), string(item->group),
+                    item->size, modified, modified, item->dir, item->file, item->symLink,
+                    item->writable, item->readable, item->executable);
+}
+
+/*!
+    Returns the owner or group name with the id \a id.
+ */
+QString FtpItemArena::string(quint32 id) const
+{
+    return strings.value(id);
+}
+
+/*!
+    Copies the names of \a root and everything below it into new blocks
+    and frees the old ones, if more than half of the name bytes and at
+    least NameWasteLimit are no longer pointed at. \a root has to be the
+    root of every node still in use.
+ */
+void FtpItemArena::compact(FtpItem *root)
+{
+    qint64 waste = nameAllocated - nameLive;
+    if (waste < NameWasteLimit || waste < nameLive)
+        return;
+    QList<char*> old = nameBlocks;
+    nameBlocks.clear();
+    nameUsed = nameCapacity = 0;
+    nameAllocated = nameLive = 0;
+
+    QVector<FtpItem*> stack;
+    stack.append(root);
+    while (!stack.isEmpty()) {
+        FtpItem *item = stack.last();
+        stack.pop_back();
+        if (item->nameData)
+            setName(item, item->nameData, item->nameSize);
+        foreach (FtpItem *child, item->children)
+            stack.append(child);
+    }
+    foreach (char *block, old)
+        qFree(block);
+}
+
+/*!
+    Copies the name \a data of \a size bytes into the name blocks and
+    points \a item at the copy.
+ */
+void FtpItemArena::setName(FtpItem *item, const char *data, int size)
+{
+    if (nameBlocks.isEmpty() || size > nameCapacity - nameUsed) {
+        nameCapacity = qMax(NameBlockSize, size);
+        nameBlocks.append(static_cast<char*>(qMalloc(nameCapacity)));
+        nameAllocated += nameCapacity;
+        nameUsed = 0;
+    }
+    char *place = nameBlocks.last() + nameUsed;
+    memcpy(place, data, size);
+    nameUsed += size;
+    nameLive += size;
+    item->nameData = place;
+    item->nameSize = size;
+}
+
+void FtpItemArena::freeNames()
+{
+    foreach (char *block, nameBlocks)
+        qFree(block);
+    nameBlocks.clear();
+    nameUsed = nameCapacity = 0;
+    nameAllocated = nameLive = 0;
+}
+
+quint32 FtpItemArena::intern(const QString &string)
+{
+    QHash<QString, quint32>::const_iterator it = stringIds.constFind(string);
+    if (it != stringIds.constEnd())
+        return it.value();
+    quint32 id = strings.count();
+    strings.append(string);
+    stringIds.insert(string, id);
+    return id;
+}
@@ -0,0 +1,102 @@
+#ifndef FTPITEM_H
+#define FTPITEM_H
+
+#include <qurlinfo.h>
+#include <qdatetime.h>
+#include <qvector.h>
+#include <qlist.h>
+#include <qhash.h>
+#include <qstringlist.h>
+
+#include <string.h>
+
+class FtpItem
+{
+public:
+    FtpItem() : nameData(0), nameSize(0), owner(0), group(0), modified(0), size(0),
+        permissions(0), dir(false), file(false), symLink(false), readable(false),
+        writable(false), executable(false), fetchedChildren(false), truncated(false),
+        waiting(false), unsorted(false), stale(false), expanded(false),
+        parent(0), row(0), shown(0), lookup(0) {}
+    ~FtpItem() { delete lookup; }
+
+    inline bool isDir() const { return dir; }
+    inline QString name() const { return QString::fromUtf8(nameData, nameSize); }
+    inline bool hasName(const QByteArray &utf8) const {
+        return utf8.size() == nameSize && memcmp(utf8.constData(), nameData, nameSize) == 0;
+    }
+    inline QDateTime lastModified() const {
+        return modified ? QDateTime::fromTime_t(modified) : QDateTime();
+    }
+
+    void append(FtpItem *child);
+    void removeChildren(int row, int count);
+    void clearChildren();
+    void renumber(int from = 0);
+    FtpItem *child(const QString &name) const;
+
+    const char *nameData;   // UTF-8, kept by the arena
+    int nameSize;
+    quint32 owner;          // interned by the arena
+    quint32 group;
+    uint modified;          // seconds since the epoch, 0 if unknown
+    qint64 size;
+    uint permissions : 12;
+    uint dir : 1;
+    uint file : 1;
+    uint symLink : 1;
+    uint readable : 1;
+    uint writable : 1;
+    uint executable : 1;
+    uint fetchedChildren : 1;
+    uint truncated : 1;     // entries past the hidden limit were dropped
+    uint waiting : 1;       // a view wants more rows than have arrived
+    uint unsorted : 1;      // sorted when shown or expanded next
+    uint stale : 1;         // not seen yet in the listing running again
+    uint expanded : 1;      // open in a view
+
+    QVector<FtpItem*> children;
+    FtpItem *parent;
+    int row;                // position in parent->children
+    int shown;              // leading children the views know about
+
+private:
+    Q_DISABLE_COPY(FtpItem)
+    mutable QMultiHash<uint, FtpItem*> *lookup;  // built for wide directories only
+};
+
+class FtpItemArena
+{
+public:
+    FtpItemArena();
+    ~FtpItemArena();
+
+    FtpItem *create(FtpItem *parent = 0);
+    void release(FtpItem *item);
+    void releaseChildren(FtpItem *item);
+    void compact(FtpItem *root);
+
+    void assign(FtpItem *item, const QUrlInfo &info);
+    QUrlInfo urlInfo(const FtpItem *item) const;
+    QString string(quint32 id) const;
+
+private:
+    QList<FtpItem*> blocks;
+    QVector<FtpItem*> freeItems;
+    int used;
+    int live;
+
+    QList<char*> nameBlocks;
+    int nameUsed;
+    int nameCapacity;
+    qint64 nameAllocated;
+    qint64 nameLive;        // bytes of names nodes still point at
+    void setName(FtpItem *item, const char *data, int size);
+    void freeNames();
+
+    QStringList strings;
+    QHash<QString, quint32> stringIds;
+    quint32 intern(const QString &string);
+};
+
+#endif // FTPITEM_H
@@ -4,17 +4,59 @@
 #include <qlocale.h>
 #include <qdirmodel.h>
 #include <qmimedata.h>
+#include <qdesktopservices.h>
 #include <qdebug.h>
 
-class FtpItem {
+#include <algorithm>
+#include <string.h>
+
+// Entries collected before they are inserted right away.
+static const int InsertBatch = 4096;
+// Longest time listed entries wait for their insertion.
+static const int InsertInterval = 100;
+// Rows shown at once by default.
+static const int DefaultPageSize = 1000;
+// Entries a directory keeps beyond its shown rows by default.
+static const int DefaultHiddenLimit = 100000;
+// Items whose display texts are kept.
+static const int DisplayCacheSize = 10000;
+
+/*
+    Orders items by a column. The keys are the numbers and UTF-8 names
+    stored in the items, so comparing never builds strings. Ties are
+    broken by name.
+ */
+class ItemLessThan
+{
 public:
-    FtpItem() : fetchedChildren(false), parent(0) {}
-    inline bool isDir() const { return info.isDir(); }
-    QUrlInfo info;
-    bool fetchedChildren;
-    QList<FtpItem> children;
-    FtpItem *parent;
-    inline bool operator <(const FtpItem &item) const { return item.info.name() < info.name(); }
+    ItemLessThan(int column, Qt::SortOrder order) : column(column), order(order) {}
+
+    bool operator()(const FtpItem *left, const FtpItem *right) const
+    {
+        if (order == Qt::DescendingOrder)
+            qSwap(left, right);
+        switch (column) {
+        case 1:
+            if (left->size != right->size)
+                return left->size < right->size;
+            break;
+        case 2:
+            if (left->dir != right->dir)
+                return left->dir < right->dir;
+            break;
+        case 3:
+            if (left->modified != right->modified)
+                return left->modified < right->modified;
+            break;
+        }
+        int common = qMin(left->nameSize, right->nameSize);
+        int n = common ? memcmp(left->nameData, right->nameData, common) : 0;
+        return n < 0 || (n == 0 && left->nameSize < right->nameSize);
+    }
+
+private:
+    int column;
+    Qt::SortOrder order;
 };
 
 /*!
@@ -34,15 +76,28 @@ public:
 /*!
     \reimp
  */
-FtpModel::FtpModel(QObject *parent) : QAbstractItemModel(parent)
+FtpModel::FtpModel(QObject *parent) : QAbstractItemModel(parent),
+    sortColumn(-1), sortOrder(Qt::AscendingOrder), displayCache(DisplayCacheSize),
+    listedCommand(0), listedAgain(false),
+    rowsPerPage(DefaultPageSize), hiddenEntries(DefaultHiddenLimit)
 {
-    connect(&connection, SIGNAL(listInfo(const QUrlInfo &)),
-            this, SLOT(gotNewListInfo(const QUrlInfo &)));
+    // The keeper has to see state changes before the model does.
+    keeper.setConnection(&connection);
+    connect(&connection, SIGNAL(listInfos(int, const FtpListing &)),
+            this, SLOT(gotNewListInfos(int, const FtpListing &)));
     connect(&connection, SIGNAL(stateChanged(int)), this, SLOT(stateChanged(int)));
     connect(&connection, SIGNAL(commandFinished(int, bool)),
             this, SLOT(commandFinished(int, bool)));
     connect(&connection, SIGNAL(commandStarted(int)), this, SLOT(commandStarted(int)));
-    root = new FtpItem();
+    insertTimer.setSingleShot(true);
+    insertTimer.setInterval(InsertInterval);
+    connect(&insertTimer, SIGNAL(timeout()), this, SLOT(insertListed()));
+    connect(&recheckTimer, SIGNAL(timeout()), this, SLOT(recheck()));
+    connect(&prefetcher, SIGNAL(listed(const QString &, const FtpListing &, int)),
+            this, SLOT(prefetched(const QString &, const FtpListing &, int)));
+    root = arena.create();
+    cache = new ListingCache(QDesktopServices::storageLocation(QDesktopServices::DataLocation)
+                             + "/listings.cache", this);
     iconProvider = new QFileIconProvider();
     filters = QDir::Readable | QDir::Writable | QDir::Executable | QDir::NoDotAndDotDot;
 }
@@ -52,7 +107,7 @@ FtpModel::FtpModel(QObject *parent) : QAbstractItemModel(parent)
  */
 FtpModel::~FtpModel()
 {
-    delete root;
+    arena.release(root);
     delete iconProvider;
 }
 
@@ -63,7 +118,7 @@ int FtpModel::rowCount(const QModelIndex &parent) const
 {
     if (!connected() || parent.column() > 0)
         return 0;
-    return ftpItem(parent)->children.count();
+    return ftpItem(parent)->shown;
 }
 
 /*!
@@ -85,7 +140,7 @@ bool FtpModel::hasChildren(const QModelIndex &parent) const
         return false;
     const FtpItem *item = ftpItem(parent);
     if (!parent.isValid())
-        return (item->children.count() > 0);
+        return (item->shown > 0);
     return item->isDir();
 }
 
@@ -94,10 +149,10 @@ bool FtpModel::hasChildren(const QModelIndex &parent) const
  */
 bool FtpModel::canFetchMore(const QModelIndex &parent) const
 {
-    if (!connected())
+    if (!connected() || keeper.isReconnecting())
         return false;
     const FtpItem *item = ftpItem(parent);
-    return (!item->fetchedChildren);
+    return (!item->fetchedChildren || item->shown < item->children.count());
 }
 
 /*!
@@ -105,19 +160,34 @@ bool FtpModel::canFetchMore(const QModelIndex &parent) const
  */
 void FtpModel::fetchMore(const QModelIndex &parent)
 {
-    if (!connected())
+    if (!connected() || keeper.isReconnecting())
         return;
 
     FtpItem *item = parent.isValid() ? static_cast<FtpItem*>(parent.internalPointer()) : root;
-    if (item->fetchedChildren)
+    // Rows that have arrived come first, then the rest of a truncated
+    // listing.
+    if (item->shown < item->children.count()) {
+        showRows(parent, item, rowsPerPage);
         return;
+    }
+    if (item->fetchedChildren) {
+        item->waiting = true;
+        return;
+    }
     qDebug() << "fetch more" << (item == root) << parent.data().toString();
     item->fetchedChildren = true;
+    item->waiting = !item->children.isEmpty();
     QString fullPath = filePath(parent);
-    int listCommand = connection.list(fullPath);
-    listing.append(fullPath);
-    listingCommands.append(listCommand);
-    qDebug() << "getting list      :" << listCommand << fullPath;
+    if (item->children.isEmpty() && cache->contains(fullPath)) {
+        // Shown right away from the last session, the listing below
+        // brings it up to date.
+        QList<QUrlInfo> infos;
+        foreach (const QUrlInfo &info, cache->listing(fullPath))
+            if (accepts(info))
+                infos.append(info);
+        addEntries(parent, item, infos, false);
+    }
+    startListing(fullPath);
 }
 
 /*!
@@ -158,9 +228,11 @@ QString FtpModel::size(const QModelIndex &index) const
 {
     if (!connected())
         return QString();
+    return displayText(ftpItem(index))->size;
+}
 
-    const FtpItem *item = ftpItem(index);
-
+QString FtpModel::sizeText(const FtpItem *item) const
+{
     if (item->isDir()) {
 #ifdef Q_OS_MAC
         return "--";
@@ -169,7 +241,7 @@ QString FtpModel::size(const QModelIndex &index) const
 #endif
     }
 
-    quint64 bytes = item->info.size();
+    quint64 bytes = item->size;
     if (bytes >= 1000000000)
         return QLocale().toString(bytes / 1000000000) + QString(" GB");
     if (bytes >= 1000000)
@@ -202,13 +274,26 @@ QString FtpModel::time(const QModelIndex &index) const
     if (!connected())
         return QString();
 
-    const FtpItem *item = ftpItem(index);
+    return displayText(ftpItem(index))->time;
+}
 
+/*!
+    Returns the texts shown for \a item, made the first time they are
+    asked for.
+ */
+const FtpModel::DisplayText *FtpModel::displayText(const FtpItem *item) const
+{
+    DisplayText *text = displayCache.object(item);
+    if (text)
+        return text;
+    text = new DisplayText;
+    text->name = item->name();
+    text->size = sizeText(item);
 #ifndef QT_NO_DATESTRING
-    return item->info.lastModified().toString(Qt::LocalDate);
-#else
-    return QString();
+    text->time = item->lastModified().toString(Qt::LocalDate);
 #endif
+    displayCache.insert(item, text);
+    return text;
 }
 
 /*!
@@ -251,9 +336,9 @@ Qt::ItemFlags FtpModel::flags(const QModelIndex &index) const
     flags |= Qt::ItemIsDragEnabled;
     if (index.column() == 0) {
         const FtpItem *item = ftpItem(index);
-        if (item->info.isWritable())
+        if (item->writable)
             flags |= Qt::ItemIsEditable;
-        if (item->isDir() && item->info.isWritable())
+        if (item->isDir() && item->writable)
             flags |= Qt::ItemIsDropEnabled;
     }
     return flags;
@@ -292,15 +377,7 @@ QModelIndex FtpModel::parent(const QModelIndex &index) const
     if (!item->parent || item->parent == (root))
         return QModelIndex();
 
-    const FtpItem *grandparent = item->parent->parent;
-    if (!grandparent)
-        return QModelIndex();
-
-    for (int i = 0; i < grandparent->children.count(); ++i)
-        if (&(grandparent->children.at(i)) == item->parent)
-            return createIndex(i, 0, item->parent);
-
-    return QModelIndex();
+    return createIndex(item->parent->row, 0, item->parent);
 }
 
 /*!
@@ -312,7 +389,7 @@ QModelIndex FtpModel::index(int row, int column, const QModelIndex &parent) cons
         return QModelIndex();
 
     const FtpItem *parentItem = ftpItem(parent);
-    return createIndex(row, column, (void*)(&(parentItem->children[row])));
+    return createIndex(row, column, parentItem->children.at(row));
 }
 
 /*!
@@ -328,22 +405,12 @@ QModelIndex FtpModel::index(const QString &path, int column) const
     QStringList builtPath = path.split("/", QString::SkipEmptyParts);
     FtpItem *item = root;
 
-    int r = 0;
-    while (!builtPath.isEmpty()) {
-        bool found = false;
-        for (int i = 0; i < item->children.count(); ++i) {
-            if (item->children.at(i).info.name() == builtPath.first()) {
-                item = &(item->children[i]);
-                builtPath.takeFirst();
-                r = i;
-                found = true;
-                break;
-            }
-        }
-        if (!found)
+    foreach (const QString &name, builtPath) {
+        item = item->child(name);
+        if (!item || item->row >= item->parent->shown)
             return QModelIndex();
     }
-    return createIndex(r, column, item);
+    return createIndex(item->row, column, item);
 }
 
 /*!
@@ -353,7 +420,7 @@ QString FtpModel::fileName(const QModelIndex &index) const
 {
     if (!connected())
         return QString();
-    return ftpItem(index)->info.name();
+    return displayText(ftpItem(index))->name;
 }
 
 /*!
@@ -366,6 +433,16 @@ bool FtpModel::isDir(const QModelIndex &index) const
     return ftpItem(index)->isDir();
 }
 
+/*!
+    Returns the size in bytes of the file stored at \a index
+ */
+qint64 FtpModel::fileSize(const QModelIndex &index) const
+{
+    if (!connected())
+        return -1;
+    return ftpItem(index)->size;
+}
+
 /*!
     Returns the currently set directory filter
  */
@@ -386,16 +463,228 @@ void FtpModel::setFilter(QDir::Filters filters)
 
 /*!
     Refreshes the directory located at \a parent.
+
+    The directory is listed again and compared with what is loaded, only
+    the entries which changed are inserted, removed or updated. The
+    subdirectories which did not change keep their contents.
  */
 void FtpModel::refresh(const QModelIndex &parent)
 {
-    if (!connected() || !isDir(parent))
+    if (!connected() || keeper.isReconnecting() || (parent.isValid() && !isDir(parent)))
        return;
     qDebug() <<"refreshing";
-    FtpItem *item = parent.isValid() ? static_cast<FtpItem*>(parent.internalPointer()) : root;
-    item->children.clear();
-    item->fetchedChildren = false;
-    fetchMore(parent);
+    listAgain(parent.isValid() ? static_cast<FtpItem*>(parent.internalPointer()) : root);
+}
+
+/*!
+    Returns the number of seconds between checks of the expanded
+    directories for changes, 0 if they are not checked.
+ */
+int FtpModel::recheckInterval() const
+{
+    return recheckTimer.isActive() ? recheckTimer.interval() / 1000 : 0;
+}
+
+/*!
+    Lists the expanded directories again every \a secs seconds, 0 turns
+    the checks off.
+ */
+void FtpModel::setRecheckInterval(int secs)
+{
+    if (secs > 0)
+        recheckTimer.start(secs * 1000);
+    else
+        recheckTimer.stop();
+}
+
+void FtpModel::recheck()
+{
+    if (!connected() || keeper.isReconnecting() || !root->fetchedChildren)
+        return;
+    recheckExpanded(root);
+}
+
+/*!
+    Lists \a item and the expanded directories below it again.
+ */
+void FtpModel::recheckExpanded(FtpItem *item)
+{
+    if (item->fetchedChildren)
+        listAgain(item);
+    for (int row = 0; row < item->shown; ++row) {
+        FtpItem *child = item->children.at(row);
+        if (child->expanded)
+            recheckExpanded(child);
+    }
+}
+
+/*!
+    Lists \a item again unless a listing of it is on the way.
+ */
+void FtpModel::listAgain(FtpItem *item)
+{
+    QString path = itemPath(item);
+    if (listing.contains(path))
+        return;
+    item->fetchedChildren = true;
+    startListing(path);
+}
+
+void FtpModel::startListing(const QString &path)
+{
+    int listCommand = connection.list(path);
+    listing.append(path);
+    listingCommands.append(listCommand);
+    prefetcher.setHeld(true);
+    qDebug() << "getting list      :" << listCommand << path;
+}
+
+/*!
+    Returns the number of rows of a directory shown at once.
+ */
+int FtpModel::pageSize() const
+{
+    return rowsPerPage;
+}
+
+/*!
+    Sets the number of rows of a directory shown at once to \a rows.
+    Further rows are shown as the views fetch more of them.
+ */
+void FtpModel::setPageSize(int rows)
+{
+    rowsPerPage = qMax(1, rows);
+}
+
+/*!
+    Returns the number of entries a directory keeps beyond its shown
+    rows.
+ */
+int FtpModel::hiddenLimit() const
+{
+    return hiddenEntries;
+}
+
+/*!
+    Sets the number of entries a directory keeps beyond its shown rows to
+    \a entries. Entries past the limit are dropped while the directory is
+    listed and listed again once the views have reached them.
+ */
+void FtpModel::setHiddenLimit(int entries)
+{
+    hiddenEntries = qMax(rowsPerPage, entries);
+}
+
+/*!
+    Returns the number of seconds listings of earlier sessions are shown
+    for while they are listed again, 0 if they are not kept.
+ */
+int FtpModel::cacheTimeToLive() const
+{
+    return cache->timeToLive();
+}
+
+void FtpModel::setCacheTimeToLive(int secs)
+{
+    cache->setTimeToLive(secs);
+}
+
+/*!
+    Returns the paths of the directories which were expanded on the
+    current server, parents first.
+ */
+QStringList FtpModel::expandedPaths() const
+{
+    return cache->expanded();
+}
+
+/*!
+    Remembers that the directory at \a index was expanded.
+ */
+void FtpModel::directoryExpanded(const QModelIndex &index)
+{
+    if (!connected() || !index.isValid())
+        return;
+    FtpItem *item = static_cast<FtpItem*>(index.internalPointer());
+    item->expanded = true;
+    cache->setExpanded(filePath(index), true);
+    sortMarked(item);
+    prefetchChildren(item, 0, 1);
+}
+
+/*!
+    Forgets that the directory at \a index was expanded.
+ */
+void FtpModel::directoryCollapsed(const QModelIndex &index)
+{
+    if (!connected() || !index.isValid())
+        return;
+    static_cast<FtpItem*>(index.internalPointer())->expanded = false;
+    cache->setExpanded(filePath(index), false);
+}
+
+/*!
+    Shows up to \a count more rows of the directory \a item.
+ */
+void FtpModel::showRows(const QModelIndex &parent, FtpItem *item, int count)
+{
+    sortMarked(item);
+    int last = qMin(item->children.count(), item->shown + count) - 1;
+    if (last < item->shown)
+        return;
+    int first = item->shown;
+    beginInsertRows(parent, first, last);
+    item->shown = last + 1;
+    endInsertRows();
+    if (item == root || item->expanded)
+        prefetchChildren(item, first, 1);
+}
+
+/*!
+    Asks the prefetcher for the directories shown below \a item from row
+    \a from on which were never listed, \a level levels below what the
+    user opened.
+ */
+void FtpModel::prefetchChildren(FtpItem *item, int from, int level)
+{
+    if (!prefetcher.isEnabled() || level > prefetcher.depth())
+        return;
+    for (int row = from; row < item->shown; ++row) {
+        const FtpItem *child = item->children.at(row);
+        if (child->isDir() && !child->fetchedChildren && child->children.isEmpty())
+            prefetcher.want(itemPath(child), level);
+    }
+}
+
+/*!
+    Fills the directory at \a path with the listing \a infos the
+    prefetcher got, unless it was listed meanwhile, and goes on with its
+    subdirectories.
+ */
+void FtpModel::prefetched(const QString &path, const FtpListing &infos, int level)
+{
+    if (!connected() || keeper.isReconnecting())
+        return;
+    QModelIndex parent = index(path);
+    if (path.isEmpty() || !parent.isValid())
+        return;
+    FtpItem *item = static_cast<FtpItem*>(parent.internalPointer());
+    if (item->fetchedChildren || !item->children.isEmpty())
+        return;
+    QList<QUrlInfo> accepted;
+    foreach (const QUrlInfo &info, infos)
+        if (accepts(info))
+            accepted.append(info);
+    item->fetchedChildren = true;
+    addEntries(parent, item, accepted, false);
+    if (item->truncated) {
+        // Left to the model's own listing when a view gets there.
+        item->fetchedChildren = false;
+        item->truncated = false;
+    } else {
+        cache->store(path, accepted);
+    }
+    prefetchChildren(item, 0, level + 1);
 }
 
 /*!
@@ -419,11 +708,17 @@ QString FtpModel::filePath(const QModelIndex &index) const
 {
     if (!connected())
         return QString();
+    return itemPath(ftpItem(index));
+}
 
-    const FtpItem *item = ftpItem(index);
+/*!
+    Returns the full path of \a item.
+ */
+QString FtpModel::itemPath(const FtpItem *item) const
+{
     QStringList path;
     while (item && item != root) {
-        path.prepend(item->info.name());
+        path.prepend(item->name());
         item = item->parent;
     }
     return path.join("/");
@@ -438,13 +733,8 @@ bool FtpModel::removeRows(int row, int count, const QModelIndex &parent)
         return false;
 
     FtpItem *item = parent.isValid() ? static_cast<FtpItem*>(parent.internalPointer()) : root;
-    beginRemoveRows(parent, row, row + count - 1);
-
     // TODO ftp remove calls
-    for (int r = 0; r < count; ++r)
-        item->children.removeAt(row);
-
-    endRemoveRows();
+    dropChildren(parent, item, row, count);
     return true;
 }
 
@@ -510,34 +800,107 @@ bool FtpModel::dropMimeData(const QMimeData *data, Qt::DropAction action,
 }
 
 /*!
-    Helper function to recursivly sort parent
+    Helper function to sort the children of \a item by the current
+    column.
   */
-void FtpModel::sort(FtpItem *parent, Qt::SortOrder order) {
-    qSort(parent->children);
-    int childCount = parent->children.count();
-    if (Qt::AscendingOrder != order) {
-        for (int i = 0; i < childCount / 2; ++i)
-            parent->children.swap(i, childCount - i - 1);
+void FtpModel::sortChildren(FtpItem *item)
+{
+    item->unsorted = false;
+    if (sortColumn < 0)
+        return;
+    qStableSort(item->children.begin(), item->children.end(),
+                ItemLessThan(sortColumn, sortOrder));
+    item->renumber();
+}
+
+/*!
+    Helper function to sort \a item if it was marked for sorting. Rows
+    no view has seen yet are sorted without a layout change.
+  */
+void FtpModel::sortMarked(FtpItem *item)
+{
+    if (!item->unsorted)
+        return;
+    if (item->shown == 0) {
+        sortChildren(item);
+        return;
+    }
+    emit layoutAboutToBeChanged();
+    sortChildren(item);
+    updatePersistentIndexes();
+    emit layoutChanged();
+}
+
+/*!
+    Helper function to mark every loaded directory below \a item for
+    sorting.
+  */
+void FtpModel::markUnsorted(FtpItem *item)
+{
+    foreach (FtpItem *child, item->children) {
+        if (!child->children.isEmpty()) {
+            child->unsorted = true;
+            markUnsorted(child);
+        }
     }
-    for (int i = 0; i < childCount; ++i)
-        sort(&parent->children[i], order);
 }
 
 /*!
     \reimp
+
+    Only the top level and the directories the views hold indexes of,
+    the expanded ones among them, are sorted right away. The other loaded
+    directories are sorted before their rows are first shown, or when
+    they are expanded.
  */
 void FtpModel::sort(int column, Qt::SortOrder order)
 {
-    Q_UNUSED(column);
-    if (!connected())
+    if (!connected() || column < 0 || column >= columnCount())
+        return;
+    if (column == sortColumn && order == sortOrder)
         return;
-    sort(root, order);
+    sortColumn = column;
+    sortOrder = order;
+
+    emit layoutAboutToBeChanged();
+    markUnsorted(root);
+    sortChildren(root);
+    foreach (const QModelIndex &index, persistentIndexList()) {
+        FtpItem *item = static_cast<FtpItem*>(index.internalPointer());
+        if (item->unsorted)
+            sortChildren(item);
+        if (item->parent->unsorted)
+            sortChildren(item->parent);
+    }
+    updatePersistentIndexes();
     emit layoutChanged();
 }
 
+/*!
+    Helper function to move the persistent indexes along with their
+    rows. Nodes do not move, only their rows change. Rows sorted past
+    the shown ones are gone for the views.
+  */
+void FtpModel::updatePersistentIndexes()
+{
+    QModelIndexList from = persistentIndexList();
+    QModelIndexList to;
+    foreach (const QModelIndex &index, from) {
+        FtpItem *item = static_cast<FtpItem*>(index.internalPointer());
+        bool shown = true;
+        for (const FtpItem *i = item; i->parent; i = i->parent)
+            shown = shown && i->row < i->parent->shown;
+        to.append(shown ? createIndex(item->row, index.column(), item) : QModelIndex());
+    }
+    changePersistentIndexList(from, to);
+}
+
 void FtpModel::setUrl(const QUrl &url)
 {
     ftpUrl = url;
+    cache->setServer(url);
+    keeper.setUrl(url);
+    prefetcher.setUrl(url);
     qDebug() << "connectToHost" ;//<< connection.connectToHost(url.host(), url.port(21));
 }
 
@@ -546,59 +909,250 @@ QUrl FtpModel::url() const
     return ftpUrl;
 }
 
-void FtpModel::gotNewListInfo(const QUrlInfo &info)
+/*!
+    Returns true if the listed entry \a info passes the filter.
+ */
+bool FtpModel::accepts(const QUrlInfo &info) const
 {
-    if (!connected())
-        return;
     // These if's are not "optimal", but it is very readable.
     if (info.isExecutable() && !(filters & QDir::Executable))
-        return;
+        return false;
     if (info.isReadable() && !(filters & QDir::Readable))
-        return;
+        return false;
     if (info.isWritable() && !(filters & QDir::Writable))
-        return;
+        return false;
     if (info.isSymLink() && filters & QDir::NoSymLinks)
-        return;
+        return false;
     if (info.isDir() && filters & QDir::Files)
-        return;
+        return false;
     if ((info.name() == "." || info.name() == "..") && filters & QDir::NoDotAndDotDot)
-        return;
+        return false;
     if (info.name().at(0) == '.' && !(filters & QDir::Hidden))
+        return false;
+    return true;
+}
+
+/*!
+    Collects a batch of entries of the directory being listed. They are
+    inserted together once enough have arrived, a little later or when
+    the listing is done, so a huge directory does not cost a relayout of
+    the views per entry.
+ */
+void FtpModel::gotNewListInfos(int id, const FtpListing &infos)
+{
+    if (!connected() || !bindListing(id))
         return;
+    foreach (const QUrlInfo &info, infos)
+        if (accepts(info))
+            listed.append(info);
+
+    if (listed.count() >= InsertBatch)
+        insertListed();
+    else if (!listed.isEmpty() && !insertTimer.isActive())
+        insertTimer.start();
+}
 
-    qDebug() << "got new Item";
-    QModelIndex idx = index(listing.first());
-    beginInsertRows(idx, rowCount(idx), rowCount(idx));
+/*!
+    Inserts the entries collected so far as one range of rows.
+ */
+void FtpModel::insertListed()
+{
+    insertTimer.stop();
+    if (listed.isEmpty())
+        return;
+    QList<QUrlInfo> infos = listed;
+    listed.clear();
+    // The directory may have gone away while it was listed.
+    if (!connected() || listedCommand == 0 || (!listedPath.isEmpty() && !listParent.isValid()))
+        return;
 
-    FtpItem *parentItem = idx.isValid() ? static_cast<FtpItem*>(idx.internalPointer()) : root;
+    FtpItem *parentItem = listParent.isValid()
+            ? static_cast<FtpItem*>(listParent.internalPointer()) : root;
+    addEntries(listParent, parentItem, infos, listedAgain);
+}
 
-    FtpItem item;
-    item.parent = parentItem;
-    item.info = info;
-    item.fetchedChildren = !info.isDir();
-    parentItem->children.append(item);
-    endInsertRows();
+/*!
+    Adds the entries \a infos to the directory \a parentItem at \a parent.
+    Listed \a again, entries already there update their items instead.
+ */
+void FtpModel::addEntries(const QModelIndex &parent, FtpItem *parentItem,
+                          const QList<QUrlInfo> &infos, bool again)
+{
+    int first = parentItem->children.count();
+    foreach (const QUrlInfo &info, infos) {
+        if (again) {
+            FtpItem *item = parentItem->child(info.name());
+            if (item) {
+                updateEntry(parent, item, info);
+                continue;
+            }
+        }
+        if (parentItem->children.count() - parentItem->shown >= hiddenEntries) {
+            // Entries already there further on are still updated.
+            parentItem->truncated = true;
+            continue;
+        }
+        FtpItem *item = arena.create(parentItem);
+        arena.assign(item, info);
+        item->fetchedChildren = !info.isDir();
+        parentItem->append(item);
+    }
+
+    // A sorted directory stays sorted, the new entries are merged in.
+    if (sortColumn >= 0 && !parentItem->unsorted && first < parentItem->children.count()) {
+        ItemLessThan lessThan(sortColumn, sortOrder);
+        QVector<FtpItem*>::iterator middle = parentItem->children.begin() + first;
+        qStableSort(middle, parentItem->children.end(), lessThan);
+        if (parentItem->shown > 0)
+            emit layoutAboutToBeChanged();
+        std::inplace_merge(parentItem->children.begin(), middle, parentItem->children.end(),
+                           lessThan);
+        parentItem->renumber();
+        if (parentItem->shown > 0) {
+            updatePersistentIndexes();
+            emit layoutChanged();
+        }
+    }
+
+    // The rest is shown page by page as the views fetch more.
+    if (parentItem->waiting) {
+        parentItem->waiting = false;
+        showRows(parent, parentItem, rowsPerPage);
+    } else {
+        showRows(parent, parentItem, rowsPerPage - parentItem->shown);
+    }
+}
+
+/*!
+    Brings \a item, a child of \a parent, up to date with the listed
+    entry \a info.
+ */
+void FtpModel::updateEntry(const QModelIndex &parent, FtpItem *item, const QUrlInfo &info)
+{
+    item->stale = false;
+    uint modified = info.lastModified().isValid() ? info.lastModified().toTime_t() : 0;
+    if (item->size == info.size() && item->modified == modified && item->dir == info.isDir()
+        && item->writable == info.isWritable() && item->readable == info.isReadable()
+        && item->executable == info.isExecutable() && item->symLink == info.isSymLink()
+        && item->permissions == uint(info.permissions()))
+        return;
+    bool wasDir = item->dir;
+    bool touched = wasDir && info.isDir() && item->modified != modified;
+    arena.assign(item, info);
+    displayCache.remove(item);
+    bool shown = item->row < item->parent->shown;
+    if (shown)
+        emit dataChanged(index(item->row, 0, parent), index(item->row, columnCount() - 1, parent));
+
+    if (wasDir && !info.isDir()) {
+        // A directory replaced by a file loses what was loaded below it.
+        // Out of view, its rows are gone for the views already.
+        if (!shown)
+            item->shown = 0;
+        if (!item->children.isEmpty())
+            dropChildren(shown ? index(item->row, 0, parent) : QModelIndex(), item, 0,
+                         item->children.count());
+        item->fetchedChildren = true;
+        item->expanded = false;
+    } else if (!wasDir && info.isDir()) {
+        item->fetchedChildren = false;
+    } else if (touched && item->fetchedChildren) {
+        // Changed below, an open directory is compared right away, a
+        // closed one when a view opens it.
+        if (item->expanded)
+            listAgain(item);
+        else
+            item->fetchedChildren = false;
+    }
+}
+
+/*!
+    Removes \a count children of \a item from \a row on, shown or not.
+ */
+void FtpModel::dropChildren(const QModelIndex &parent, FtpItem *item, int row, int count)
+{
+    int shown = qMax(0, qMin(item->shown, row + count) - row);
+    if (shown > 0)
+        beginRemoveRows(parent, row, row + shown - 1);
+    QVector<FtpItem*> removed = item->children.mid(row, count);
+    item->removeChildren(row, count);
+    foreach (FtpItem *child, removed) {
+        forgetTexts(child);
+        arena.release(child);
+    }
+    if (shown > 0)
+        endRemoveRows();
+    // Refreshes release nodes for as long as the session lasts.
+    arena.compact(root);
+}
+
+/*!
+    Drops the cached texts of \a item and everything below it. Released
+    nodes are reused, their texts must not go with them.
+ */
+void FtpModel::forgetTexts(const FtpItem *item)
+{
+    displayCache.remove(item);
+    foreach (const FtpItem *child, item->children)
+        forgetTexts(child);
+}
+
+/*!
+    Removes the children of \a item which the listing run again did not
+    bring, in ranges of adjacent rows.
+ */
+void FtpModel::dropStale(const QModelIndex &parent, FtpItem *item)
+{
+    int row = item->children.count();
+    while (row > 0) {
+        if (!item->children.at(row - 1)->stale) {
+            --row;
+            continue;
+        }
+        int end = row;
+        while (row > 0 && item->children.at(row - 1)->stale)
+            --row;
+        dropChildren(parent, item, row, end - row);
+    }
 }
 
 void FtpModel::stateChanged(int state)
 {
     if (!connected() && root->fetchedChildren) {
-        delete root;
-        root = new FtpItem();
+        listed.clear();
+        listedCommand = 0;
+        displayCache.clear();
+        prefetcher.clear();
+        prefetcher.setHeld(false);
+        arena.release(root);
+        root = arena.create();
         reset();
     }
+    if (state == QFtp::Unconnected && keeper.isReconnecting()) {
+        // Listings in flight are gone with the session, fetch them again
+        // once it is back.
+        foreach (const QString &path, listing) {
+            QModelIndex idx = index(path);
+            FtpItem *item = idx.isValid() ? static_cast<FtpItem*>(idx.internalPointer()) : root;
+            item->fetchedChildren = false;
+        }
+        listing.clear();
+        listingCommands.clear();
+        listed.clear();
+        listedCommand = 0;
+        prefetcher.setHeld(false);
+    }
     switch
  (state) {
     case 0: qDebug() << "QFtp::Unconnected"; break;
     case 1: qDebug() << "QFtp::HostLookup"; break;
     case 2: qDebug() << "QFtp::Connecting"; break;
-    case 3: {
-        qDebug() << "QFtp::Connected";
-        qDebug() << "login" << connection.login(ftpUrl.userName(), ftpUrl.password());
+    case 3: qDebug() << "QFtp::Connected"; break;
+    case 4: {
+        qDebug() << "QFtp::LoggedIn";
         fetchMore(QModelIndex());
         break;
     }
-    case 4: qDebug() << "QFtp::LoggedIn"; break;
     case 5: qDebug() << "QFtp::Closing"; break;
     default:
         qDebug() << "new state" << state;
@@ -608,6 +1162,34 @@ void FtpModel::stateChanged(int state)
 void FtpModel::commandStarted(int id)
 {
     qDebug() << "started operation :" << id;
+    bindListing(id);
+}
+
+/*!
+    Makes the LIST command \a id the one whose entries are collected,
+    if it is one of the model's listings. Entries are bound by command
+    id, so they never end up below the directory of another listing.
+    Returns false if \a id is no listing of the model.
+ */
+bool FtpModel::bindListing(int id)
+{
+    if (listedCommand == id)
+        return true;
+    int at = listingCommands.indexOf(id);
+    if (at < 0)
+        return false;
+    insertListed();
+    // Every entry of the listing goes below the same directory.
+    listedCommand = id;
+    listedPath = listing.at(at);
+    listParent = index(listedPath);
+    const FtpItem *item = listParent.isValid()
+            ? static_cast<const FtpItem*>(listParent.internalPointer()) : root;
+    listedAgain = !item->children.isEmpty();
+    // Whatever the listing does not bring again is gone.
+    foreach (FtpItem *child, item->children)
+        child->stale = true;
+    return true;
 }
 
 void FtpModel::commandFinished(int id, bool error)
@@ -616,9 +1198,39 @@ void FtpModel::commandFinished(int id, bool error)
         qWarning() << "FtpModel" << connection.errorString();
 
     qDebug() << "finished operation:" << id << (error ? "Error" : "");
-    if (!listingCommands.isEmpty() && listingCommands.first() == id) {
-        listing.pop_front();
-        listingCommands.pop_front();
+    int at = listingCommands.indexOf(id);
+    if (at < 0)
+        return;
+    // An empty directory delivers no entries, its children are gone.
+    bool bound = error ? listedCommand == id : bindListing(id);
+    if (bound) {
+        insertListed();
+        FtpItem *item = listParent.isValid()
+                ? static_cast<FtpItem*>(listParent.internalPointer()) : root;
+        bool gone = !listedPath.isEmpty() && !listParent.isValid();
+        if (!gone && !error) {
+            // A truncated listing did not look at every entry.
+            if (listedAgain && !item->truncated)
+                dropStale(listParent, item);
+            if (!item->truncated) {
+                FtpListing infos;
+                foreach (const FtpItem *child, item->children)
+                    infos.append(arena.urlInfo(child));
+                cache->store(listedPath, infos);
+            }
+        }
+        if (!gone && item->truncated) {
+            // Listed again when the views get to the end of what was kept.
+            item->fetchedChildren = false;
+            item->truncated = false;
+        }
+        listedCommand = 0;
+        listedPath.clear();
+        listParent = QPersistentModelIndex();
     }
+    listing.removeAt(at);
+    listingCommands.removeAt(at);
+    if (listingCommands.isEmpty())
+        prefetcher.setHeld(false);
 }
 
@@ -7,10 +7,17 @@
 #include <qurl.h>
 #include <qhash.h>
 #include <qpair.h>
+#include <qtimer.h>
+#include <qcache.h>
+
+#include "ftpengine.h"
+#include "sessionkeeper.h"
+#include "ftpitem.h"
+#include "listingcache.h"
+#include "listingprefetcher.h"
 
 
 
-class FtpItem;
 class QFileIconProvider;
 
 class FtpModel : public QAbstractItemModel
@@ -49,6 +56,7 @@ public:
     QString filePath(const QModelIndex &index) const;
     QIcon fileIcon(const QModelIndex &index) const;
     bool isDir(const QModelIndex &index) const;
+    qint64 fileSize(const QModelIndex &index) const;
 
     QUrl url() const;
 
@@ -60,36 +68,108 @@ public:
     void setFilter(QDir::Filters filters);
 
     void refresh(const QModelIndex &parent = QModelIndex());
+    int recheckInterval() const;
+    void setRecheckInterval(int secs);
+
+    int pageSize() const;
+    void setPageSize(int rows);
+    int hiddenLimit() const;
+    void setHiddenLimit(int entries);
+
+    int cacheTimeToLive() const;
+    void setCacheTimeToLive(int secs);
+    QStringList expandedPaths() const;
 
     // For progress etc...
-    QFtp connection;
+    FtpEngine connection;
+    // Keeps connection logged in, the tree survives reconnects.
+    SessionKeeper keeper;
+    // Lists directories next to the expanded ones on its own session.
+    ListingPrefetcher prefetcher;
 
     inline bool connected() const {
-        return (connection.state() == QFtp::Connected || connection.state() == QFtp::LoggedIn);
+        return (connection.state() == QFtp::Connected || connection.state() == QFtp::LoggedIn
+                || keeper.isReconnecting());
     }
 
 
 
 public slots:
     void setUrl(const QUrl &url);
+    void directoryExpanded(const QModelIndex &index);
+    void directoryCollapsed(const QModelIndex &index);
 
 
 private slots:
-    void gotNewListInfo(const QUrlInfo &info);
+    void gotNewListInfos(int id, const FtpListing &infos);
+    void insertListed();
     void stateChanged(int state);
     void commandStarted(int id);
     void commandFinished(int id, bool error);
+    void prefetched(const QString &path, const FtpListing &infos, int level);
+    void recheck();
 
 private:
     QUrl ftpUrl;
     QDir::Filters filters;
     QFileIconProvider *iconProvider;
+    FtpItemArena arena;
     FtpItem *root;
-    void sort(FtpItem *parent, Qt::SortOrder order);
+
+    // Sorting of the loaded directories, column -1 keeps listing order.
+    int sortColumn;
+    Qt::SortOrder sortOrder;
+    void sortChildren(FtpItem *item);
+    void sortMarked(FtpItem *item);
+    void markUnsorted(FtpItem *item);
+    void updatePersistentIndexes();
+
+    // Texts of the items painted lately.
+    struct DisplayText {
+        QString name;
+        QString size;
+        QString time;
+    };
+    mutable QCache<const FtpItem*, DisplayText> displayCache;
+    const DisplayText *displayText(const FtpItem *item) const;
+    QString sizeText(const FtpItem *item) const;
 
     QStringList listing;
     QList<int> listingCommands;
 
+    // The LIST command running, the directory it fills and what it
+    // delivered since the last insert.
+    int listedCommand;
+    QString listedPath;
+    QPersistentModelIndex listParent;
+    bool listedAgain;
+    QList<QUrlInfo> listed;
+    QTimer insertTimer;
+    bool bindListing(int id);
+    bool accepts(const QUrlInfo &info) const;
+    void addEntries(const QModelIndex &parent, FtpItem *item, const QList<QUrlInfo> &infos,
+                    bool again);
+    void updateEntry(const QModelIndex &parent, FtpItem *item, const QUrlInfo &info);
+    void dropChildren(const QModelIndex &parent, FtpItem *item, int row, int count);
+    void dropStale(const QModelIndex &parent, FtpItem *item);
+    void forgetTexts(const FtpItem *item);
+    void showRows(const QModelIndex &parent, FtpItem *item, int count);
+    void startListing(const QString &path);
+    void listAgain(FtpItem *item);
+
+    // Lists the expanded directories again now and then.
+    QTimer recheckTimer;
+    void recheckExpanded(FtpItem *item);
+
+    // Listings of earlier sessions.
+    ListingCache *cache;
+
+    void prefetchChildren(FtpItem *item, int from, int level);
+    QString itemPath(const FtpItem *item) const;
+
+    int rowsPerPage;
+    int hiddenEntries;
+
     QMap<int, QPair<QString, QString> > renameCommands;
 
     QHash<int, QFile*> copyCommands;
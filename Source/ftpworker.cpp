@@ -0,0 +1,1532 @@
+#include "ftpworker.h"
+
+#include <qtcpsocket.h>
+#include <qtimer.h>
+#include <qregexp.h>
+#include <qstringlist.h>
+#include <qdatetime.h>
+#include <qdebug.h>
+
+#include <ctype.h>
+#include <string.h>
+#include <zlib.h>
+
+#ifdef Q_OS_LINUX
+#include <qfile.h>
+#include <qsocketnotifier.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#endif
+
+// Bytes queued on the data connection before an upload waits for it.
+static const qint64 UploadChunk = 64 * 1024;
+// Bytes handed to the kernel per sendfile() call or mapped at once.
+static const qint64 DirectChunk = 8 * 1024 * 1024;
+// Bytes inflated at once from a compressed download.
+static const int InflateChunk = 256 * 1024;
+
+/*!
+    \class FtpWorker ftpworker.h
+
+    \brief The FtpWorker class speaks the ftp protocol for one FtpEngine,
+    on the engine's own thread.
+
+    The engine builds operations and hands them over with post(), the
+    only member which may be called from another thread. Everything the
+    worker learns goes back as signals, which reach the engine queued.
+
+    \sa FtpEngine
+*/
+
+FtpWorker::FtpWorker(QObject *parent)
+    : QObject(parent), data(0), standby(0), transfer(0), aborting(0), lastTaken(0),
+    currentState(QFtp::Unconnected), lastError(QFtp::NoError), lastReply(0),
+    depth(8), pumpScheduled(false), prepare(false), direct(true),
+    writable(0), mapped(0), mappedStart(0), mappedLength(0), zstream(0), zstreamOut(false),
+    compressing(0), replyCode(0)
+{
+    control = new QTcpSocket(this);
+    connect(control, SIGNAL(connected()), this, SLOT(controlConnected()));
+    connect(control, SIGNAL(readyRead()), this, SLOT(controlReadyRead()));
+    connect(control, SIGNAL(disconnected()), this, SLOT(controlDisconnected()));
+    connect(control, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(controlError()));
+    connect(control, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+            this, SLOT(controlStateChanged()));
+}
+
+FtpWorker::~FtpWorker()
+{
+    shutdown();
+    foreach (Step *s, inFlight) {
+        if (!s->op)
+            delete s;
+    }
+    qDeleteAll(operations);
+    qDeleteAll(posted);
+}
+
+/*!
+    Queues \a op, whose id is set already. May be called from any thread.
+ */
+void FtpWorker::post(Operation *op)
+{
+    QMutexLocker locker(&postMutex);
+    posted.append(op);
+    if (posted.count() == 1)
+        QMetaObject::invokeMethod(this, "takePosted", Qt::QueuedConnection);
+}
+
+void FtpWorker::takePosted()
+{
+    QList<Operation*> ops;
+    {
+        QMutexLocker locker(&postMutex);
+        ops = posted;
+        posted.clear();
+    }
+    foreach (Operation *op, ops) {
+        lastTaken = op->id;
+        operations.append(op);
+    }
+    if (!ops.isEmpty())
+        schedulePump();
+}
+
+/*!
+    Closes all connections. Called on the worker's thread as the thread
+    finishes, so no socket outlives it.
+ */
+void FtpWorker::shutdown()
+{
+    closeData();
+    closeStandby();
+    if (control) {
+        control->disconnect(this);
+        control->abort();
+        delete control;
+        control = 0;
+    }
+}
+
+/*!
+    Aborts the current operation and clears the pending ones. A running
+    transfer is stopped with ABOR.
+ */
+void FtpWorker::abort()
+{
+    takePosted();
+    abortCurrent(tr("Aborted"));
+}
+
+/*!
+    Aborts the current operation, reporting \a reason as the error. A
+    transfer stopped without \a error is reported as finished, with the
+    pending operations kept.
+ */
+void FtpWorker::abortCurrent(const QString &reason, bool error)
+{
+    if (operations.isEmpty())
+        return;
+
+    Operation *current = operations.first();
+    if (current->type == QFtp::ConnectToHost) {
+        control->abort();
+        failAll(QFtp::UnknownError, reason);
+        return;
+    }
+
+    if (transfer && transfer->op == current) {
+        control->write("ABOR\r\n");
+        Step *abor = new Step;
+        abor->kind = Barrier;
+        abor->line = "ABOR";
+        // The transfer answers first if it has not yet, then ABOR.
+        inFlight.enqueue(abor);
+        closeData();
+        transfer = 0;
+        ++aborting;
+    }
+    if (error) {
+        lastError = QFtp::UnknownError;
+        lastErrorString = reason;
+    }
+    finishOperation(current, error);
+}
+
+/*!
+    Drops the operations which have not been started yet.
+ */
+void FtpWorker::clearPendingCommands()
+{
+    takePosted();
+    foreach (Operation *op, operations) {
+        if (op->started)
+            continue;
+        operations.removeAll(op);
+        delete op;
+    }
+}
+
+void FtpWorker::setPipelineDepth(int depth)
+{
+    this->depth = qMax(1, depth);
+}
+
+void FtpWorker::setPrenegotiation(bool enabled)
+{
+    prepare = enabled;
+}
+
+void FtpWorker::setZeroCopy(bool enabled)
+{
+    direct = enabled;
+}
+
+FtpWorker::Step *FtpWorker::step(Operation *op, StepKind kind, const QByteArray &line)
+{
+    Step *s = new Step;
+    s->kind = kind;
+    s->line = line;
+    s->op = op;
+    op->steps.append(s);
+    return s;
+}
+
+void FtpWorker::schedulePump()
+{
+    if (pumpScheduled)
+        return;
+    pumpScheduled = true;
+    QTimer::singleShot(0, this, SLOT(pump()));
+}
+
+/*!
+    Returns the first step not sent yet, in operation order.
+ */
+FtpWorker::Step *FtpWorker::nextStep() const
+{
+    foreach (Operation *op, operations) {
+        for (int i = op->next; i < op->steps.count(); ++i) {
+            if (!op->steps.at(i)->skipped)
+                return op->steps.at(i);
+        }
+    }
+    return 0;
+}
+
+/*!
+    Returns true if \a s may go out now. Plain steps may be pipelined
+    behind other plain steps, everything else waits for the replies to
+    all steps sent before it. Only TYPE and PASV, which cannot disturb a
+    running transfer, are sent behind one.
+ */
+bool FtpWorker::canSend(const Step *s) const
+{
+    if (aborting)
+        return false;
+    if (s->kind == Connect)
+        return inFlight.isEmpty() && control->state() == QAbstractSocket::UnconnectedState;
+    if (control->state() != QAbstractSocket::ConnectedState)
+        return false;
+    if (inFlight.count() >= depth)
+        return false;
+    if (s->kind == Transfer)
+        return inFlight.isEmpty() && !transfer;
+    if (s->kind == Passive) {
+        if (standby)
+            return false;
+        foreach (const Step *sent, inFlight) {
+            if (sent->kind == Passive)
+                return false;
+        }
+    }
+
+    bool ahead = s->kind == Passive || s->line.startsWith("TYPE ");
+    foreach (const Step *sent, inFlight) {
+        if (sent->kind == Transfer && !ahead)
+            return false;
+        if (sent->kind != Plain && sent->kind != Passive && sent->kind != Transfer)
+            return false;
+    }
+    if (s->kind == Plain || s->kind == Passive)
+        return true;
+    return inFlight.isEmpty();
+}
+
+/*!
+    Returns true if a data connection is ready for the next transfer.
+ */
+bool FtpWorker::hasSpareChannel() const
+{
+    return standby || (data && !transfer);
+}
+
+bool FtpWorker::sparePending() const
+{
+    foreach (const Step *sent, inFlight) {
+        if (sent->spare)
+            return true;
+    }
+    return false;
+}
+
+/*!
+    Sends a PASV of its own during a transfer, so the data connection of
+    the next one is open by the time it is queued.
+ */
+void FtpWorker::prepareChannel()
+{
+    if (!prepare || !transfer || standby || sparePending())
+        return;
+    Step *s = new Step;
+    s->kind = Passive;
+    s->line = "PASV";
+    s->spare = true;
+    if (!canSend(s)) {
+        delete s;
+        return;
+    }
+    qDebug() << "ftp >" << s->line << "(ahead)";
+    control->write(s->line + "\r\n");
+    inFlight.enqueue(s);
+}
+
+void FtpWorker::pump()
+{
+    pumpScheduled = false;
+    Step *s;
+    while ((s = nextStep())) {
+        Operation *op = s->op;
+        if (s->kind != Connect && control->state() == QAbstractSocket::UnconnectedState) {
+            if (s->kind == Quit) {
+                op->next = op->steps.count();
+                finishOperation(op, false);
+            } else {
+                lastError = QFtp::NotConnected;
+                lastErrorString = tr("Not connected");
+                finishOperation(op, true);
+            }
+            continue;
+        }
+        if (s->deflate && (s->line == "MODE S" ? !op->deflate : !offersDeflate())) {
+            // The server does not compress, or refused to.
+            s->skipped = true;
+            advance(op);
+            continue;
+        }
+        if (s->kind == Passive && (hasSpareChannel() || sparePending())) {
+            if (!hasSpareChannel())
+                break; // use the one about to be negotiated
+            s->skipped = true;
+            continue;
+        }
+        if (s->kind == Transfer && inFlight.isEmpty() && !transfer && !data) {
+            int passive = op->steps.indexOf(s);
+            while (--passive >= 0 && op->steps.at(passive)->kind != Passive)
+                ;
+            if (passive >= 0 && op->steps.at(passive)->skipped) {
+                // The server dropped the connection negotiated ahead.
+                op->steps.at(passive)->skipped = false;
+                op->next = passive;
+                continue;
+            }
+            // PASV succeeded but the data connection is gone already.
+            lastError = QFtp::UnknownError;
+            lastErrorString = tr("Data connection failed");
+            finishOperation(op, true);
+            continue;
+        }
+        if (!canSend(s))
+            break;
+        send(s);
+    }
+    prepareChannel();
+}
+
+void FtpWorker::send(Step *s)
+{
+    Operation *op = s->op;
+    op->next = op->steps.indexOf(s) + 1;
+    op->started = true;
+    announce();
+
+    inFlight.enqueue(s);
+    if (s->kind == Connect) {
+        control->connectToHost(op->host, op->port);
+        return;
+    }
+
+    if (s->kind == Transfer) {
+        transfer = s;
+        listBuffer.clear();
+        if (op->type == QFtp::List && s->line.startsWith("LIST") && features.contains("MLST")) {
+            // The machine readable listing is unambiguous, exact to the
+            // second and cheaper to parse.
+            s->line.replace(0, 4, "MLSD");
+            op->machine = true;
+        }
+        if (op->deflate)
+            startZlib(op);
+    }
+    if (s->line == "MODE Z")
+        compressing = op;
+    else if (s->line == "MODE S")
+        compressing = 0;
+    if (s->kind == Quit)
+        setState(QFtp::Closing);
+    qDebug() << "ftp >" << (s->line.startsWith("PASS ") ? QByteArray("PASS ***") : s->line);
+    control->write(s->line + "\r\n");
+
+    if (s->kind == Transfer && op->type == QFtp::Put && data
+        && data->state() == QAbstractSocket::ConnectedState)
+        writeData();
+}
+
+void FtpWorker::controlConnected()
+{
+    setState(QFtp::Connected);
+}
+
+/*!
+    Splits the control channel into replies. A reply is either a single
+    line "xyz text" or starts with "xyz-" and runs up to the next line
+    beginning with "xyz ".
+ */
+void FtpWorker::controlReadyRead()
+{
+    lineBuffer += control->readAll();
+    int from = 0;
+    int nl;
+    while ((nl = lineBuffer.indexOf('\n', from)) >= 0) {
+        QByteArray line = lineBuffer.mid(from, nl - from);
+        from = nl + 1;
+        if (line.endsWith('\r'))
+            line.chop(1);
+
+        bool isCode = line.size() >= 3 && isdigit(uchar(line.at(0)))
+                && isdigit(uchar(line.at(1))) && isdigit(uchar(line.at(2)));
+        int code = isCode ? line.left(3).toInt() : 0;
+
+        if (replyCode) {
+            if (code == replyCode && line.size() >= 4 && line.at(3) == ' ') {
+                QByteArray text = replyText + '\n' + line.mid(4);
+                replyCode = 0;
+                replyText.clear();
+                handleReply(code, text);
+            } else {
+                replyText += '\n' + line;
+            }
+        } else if (isCode && line.size() >= 4 && line.at(3) == '-') {
+            replyCode = code;
+            replyText = line.mid(4);
+        } else if (isCode) {
+            handleReply(code, line.mid(4));
+        }
+    }
+    lineBuffer.remove(0, from);
+}
+
+void FtpWorker::controlDisconnected()
+{
+    qDebug() << "ftp control closed";
+    closeData();
+    closeStandby();
+    transfer = 0;
+    aborting = 0;
+    compressing = 0;
+    replyCode = 0;
+    lineBuffer.clear();
+    if (!features.isEmpty()) {
+        features.clear();
+        emit featuresChanged(QStringList());
+    }
+
+    if (!operations.isEmpty() && operations.first()->type == QFtp::Close) {
+        Operation *op = operations.first();
+        foreach (Step *s, inFlight) {
+            if (s->op == op)
+                inFlight.removeAll(s);
+        }
+        op->next = op->steps.count();
+        advance(op);
+    }
+    failAll(QFtp::UnknownError, tr("Connection closed"));
+    setState(QFtp::Unconnected);
+}
+
+void FtpWorker::controlError()
+{
+    QAbstractSocket::SocketError socketError = control->error();
+    if (socketError == QAbstractSocket::RemoteHostClosedError)
+        return; // controlDisconnected() follows
+    qWarning() << "FtpWorker" << control->errorString();
+
+    QFtp::Error error = QFtp::UnknownError;
+    if (socketError == QAbstractSocket::HostNotFoundError)
+        error = QFtp::HostNotFound;
+    else if (socketError == QAbstractSocket::ConnectionRefusedError)
+        error = QFtp::ConnectionRefused;
+    failAll(error, control->errorString());
+    if (control->state() == QAbstractSocket::UnconnectedState)
+        setState(QFtp::Unconnected);
+}
+
+void FtpWorker::controlStateChanged()
+{
+    switch (control->state()) {
+    case QAbstractSocket::HostLookupState:
+        setState(QFtp::HostLookup);
+        break;
+    case QAbstractSocket::ConnectingState:
+        setState(QFtp::Connecting);
+        break;
+    default:
+        break;
+    }
+}
+
+void FtpWorker::handleReply(int code, const QByteArray &text)
+{
+    qDebug() << "ftp <" << code << text;
+
+    if (inFlight.isEmpty()) {
+        if (code == 421) {
+            // The server is going away.
+            control->disconnectFromHost();
+        }
+        return;
+    }
+
+    Step *s = inFlight.head();
+    if (code < 200)
+        return; // preliminary, the final reply follows
+    inFlight.dequeue();
+
+    if (!s->op) {
+        // Negotiated ahead, or left over from an aborted or failed operation.
+        if (s->spare && code == 227)
+            openData(text);
+        if (s->line == "ABOR")
+            --aborting;
+        delete s;
+        schedulePump();
+        return;
+    }
+
+    if (code >= 400 || (s->kind == User && code == 332))
+        failed(s, code, text);
+    else
+        succeeded(s, code, text);
+    schedulePump();
+}
+
+void FtpWorker::succeeded(Step *s, int code, const QByteArray &text)
+{
+    Operation *op = s->op;
+
+    switch (s->kind) {
+    case User:
+        if (code == 230) {
+            // No password needed.
+            for (int i = op->steps.indexOf(s) + 1; i < op->steps.count(); ++i) {
+                if (op->steps.at(i)->line.startsWith("PASS "))
+                    op->steps.at(i)->skipped = true;
+            }
+        }
+        break;
+    case Passive:
+        openData(text);
+        if (!data) {
+            failed(s, code, text);
+            return;
+        }
+        break;
+    case Transfer:
+        s->replied = true;
+        if (!s->dataDone)
+            return; // finishTransfer() once the data connection is drained
+        finishTransfer();
+        return;
+    default:
+        break;
+    }
+
+    if (op->type == QFtp::RawCommand)
+        emit rawCommandReply(code, QString::fromUtf8(text));
+    if (op->type == QFtp::Get && s->line.startsWith("SIZE "))
+        op->total = text.trimmed().toLongLong();
+    if (s->line == "MODE Z")
+        op->deflate = true;
+    if (s->line == "FEAT")
+        readFeatures(text);
+    if (s->line.startsWith("MLST "))
+        readFacts(op->id, text);
+    advance(op);
+}
+
+void FtpWorker::failed(Step *s, int code, const QByteArray &text)
+{
+    Operation *op = s->op;
+    if (s->line == "MODE Z")
+        compressing = 0;
+    if (s->optional) {
+        advance(op);
+        return;
+    }
+    if (op->type == QFtp::RawCommand)
+        emit rawCommandReply(code, QString::fromUtf8(text));
+    if (transfer && transfer->op == op) {
+        closeData();
+        transfer = 0;
+    }
+    lastError = QFtp::UnknownError;
+    lastErrorString = QString::fromUtf8(text);
+    lastReply = code;
+    finishOperation(op, true);
+}
+
+/*!
+    Finishes \a op once all its steps have been answered.
+ */
+void FtpWorker::advance(Operation *op)
+{
+    while (op->next < op->steps.count() && op->steps.at(op->next)->skipped)
+        ++op->next;
+    if (op->next < op->steps.count())
+        return;
+    foreach (const Step *s, inFlight) {
+        if (s->op == op)
+            return;
+    }
+    if (transfer && transfer->op == op)
+        return;
+    finishOperation(op, false);
+}
+
+void FtpWorker::finishTransfer()
+{
+    Operation *op = transfer->op;
+    if (op->type != QFtp::List)
+        progress(op, true);
+    transfer = 0;
+    closeData();
+    data = standby;
+    standby = 0;
+    advance(op);
+}
+
+/*!
+    Reports \a op as finished. Its steps still waiting for a reply are
+    kept, so their replies are not taken for the replies of others. On
+    \a error, the pending operations are dropped without a signal.
+ */
+void FtpWorker::finishOperation(Operation *op, bool error)
+{
+    QList<Operation*> dropped;
+    dropped.append(op);
+    if (error) {
+        // Whatever was posted up to now is pending as well.
+        takePosted();
+        dropped = operations;
+        closeData();
+        closeStandby();
+    }
+
+    foreach (Operation *o, dropped) {
+        foreach (Step *s, inFlight) {
+            if (s->op == o) {
+                o->steps.removeAll(s);
+                s->op = 0;
+            }
+        }
+        if (transfer && transfer->op == o) {
+            transfer = 0;
+            closeData();
+        }
+        operations.removeAll(o);
+    }
+
+    if (!error && op->type == QFtp::Login)
+        setState(QFtp::LoggedIn);
+
+    if (!op->announced)
+        emit commandStarted(op->id);
+    if (dropped.contains(compressing))
+        restoreMode();
+    int id = op->id;
+    qDeleteAll(dropped);
+    int reply = error ? lastReply : 0;
+    lastReply = 0;
+    emit commandFinished(id, error, lastError, reply, lastErrorString, error ? lastTaken : 0);
+    announce();
+    schedulePump();
+}
+
+/*!
+    Reports the first operation as started once it has sent a step. The
+    steps of later operations may go out earlier, pipelined, but as with
+    QFtp an operation starts only after the one before it finished, so
+    whatever it reports belongs to it.
+ */
+void FtpWorker::announce()
+{
+    if (operations.isEmpty())
+        return;
+    Operation *op = operations.first();
+    if (!op->started || op->announced)
+        return;
+    op->announced = true;
+    emit commandStarted(op->id);
+}
+
+/*!
+    Fails the current operation with \a error and drops the others,
+    after the control connection broke down.
+ */
+void FtpWorker::failAll(QFtp::Error error, const QString &text)
+{
+    foreach (Step *s, inFlight) {
+        if (!s->op)
+            delete s;
+    }
+    inFlight.clear();
+    aborting = 0;
+    if (operations.isEmpty())
+        return;
+    lastError = error;
+    lastErrorString = text;
+    finishOperation(operations.first(), true);
+}
+
+/*!
+    Opens the data connection announced in the PASV reply \a text. The
+    address in the reply is ignored in favour of the control connection's
+    peer, which is also right behind NAT. During a transfer the new
+    connection waits as standby until the transfer is done.
+ */
+void FtpWorker::openData(const QByteArray &text)
+{
+    QRegExp rx("(\\d+),(\\d+),(\\d+),(\\d+),(\\d+),(\\d+)");
+    if (rx.indexIn(QString::fromLatin1(text)) < 0)
+        return;
+    quint16 dataPort = (rx.cap(5).toUInt() << 8) + rx.cap(6).toUInt();
+
+    QTcpSocket *socket = new QTcpSocket(this);
+    connect(socket, SIGNAL(connected()), this, SLOT(dataConnected()));
+    connect(socket, SIGNAL(readyRead()), this, SLOT(dataReadyRead()));
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(dataBytesWritten()));
+    connect(socket, SIGNAL(disconnected()), this, SLOT(dataDisconnected()));
+    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(dataError()));
+    socket->connectToHost(control->peerAddress(), dataPort);
+
+    if (transfer) {
+        closeStandby();
+        standby = socket;
+    } else {
+        closeData();
+        data = socket;
+    }
+}
+
+void FtpWorker::closeData()
+{
+    releaseDirect();
+    endZlib();
+    if (!data)
+        return;
+    data->disconnect(this);
+    data->abort();
+    data->deleteLater();
+    data = 0;
+}
+
+void FtpWorker::closeStandby()
+{
+    if (!standby)
+        return;
+    standby->disconnect(this);
+    standby->abort();
+    standby->deleteLater();
+    standby = 0;
+}
+
+void FtpWorker::dataConnected()
+{
+    if (sender() != data)
+        return;
+    if (transfer && transfer->op->type == QFtp::Put)
+        writeData();
+}
+
+/*!
+    Feeds the upload into the data connection, keeping at most
+    UploadChunk bytes queued, and closes it at the end of the device.
+ */
+void FtpWorker::writeData()
+{
+    Operation *op = transfer->op;
+    if (!op->device) {
+        data->disconnectFromHost();
+        return;
+    }
+    if (op->deflate) {
+        writeCompressed(op);
+        return;
+    }
+    if (sendDirect(op))
+        return;
+    while (data->bytesToWrite() < UploadChunk && !op->device->atEnd()) {
+        QByteArray chunk = op->device->read(UploadChunk);
+        if (chunk.isEmpty())
+            break;
+        data->write(chunk);
+        op->done += chunk.size();
+        progress(op);
+    }
+    if (op->device->atEnd() && data->bytesToWrite() == 0)
+        data->disconnectFromHost();
+}
+
+/*!
+    Sends the upload \a op without copying it through user space, as far
+    as the socket takes it right now. Returns false if \a op has to go
+    the buffered way.
+ */
+bool FtpWorker::sendDirect(Operation *op)
+{
+#ifdef Q_OS_LINUX
+    if (op->mode == Undecided) {
+        QFile *file = qobject_cast<QFile*>(op->device);
+        op->mode = (direct && file && file->handle() >= 0 && !file->isSequential())
+                ? SendFile : Buffered;
+        if (op->mode == Buffered)
+            return false;
+        op->position = file->pos();
+    }
+    if (op->mode == Buffered)
+        return false;
+
+    int fd = static_cast<QFile*>(op->device)->handle();
+    int socket = data->socketDescriptor();
+    qint64 size = op->device->size();
+    qint64 sent = 0;
+
+    while (op->position < size) {
+        qint64 chunk = qMin(size - op->position, DirectChunk);
+        ssize_t n;
+        if (op->mode == SendFile) {
+            off_t offset = op->position;
+            n = ::sendfile(socket, fd, &offset, chunk);
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS)) {
+                op->mode = Mapped;
+                continue;
+            }
+        } else {
+            if (!mapped || op->position < mappedStart
+                || op->position >= mappedStart + mappedLength) {
+                if (mapped)
+                    ::munmap(mapped, mappedLength);
+                mapped = 0;
+                long page = sysconf(_SC_PAGESIZE);
+                mappedStart = op->position - op->position % page;
+                mappedLength = qMin(size - mappedStart, DirectChunk);
+                void *map = ::mmap(0, mappedLength, PROT_READ, MAP_SHARED, fd, mappedStart);
+                if (map == MAP_FAILED) {
+                    mappedLength = 0;
+                    op->mode = Buffered;
+                    op->device->seek(op->position);
+                    return false;
+                }
+                ::madvise(map, mappedLength, MADV_SEQUENTIAL);
+                mapped = static_cast<uchar*>(map);
+            }
+            qint64 at = op->position - mappedStart;
+            n = ::send(socket, mapped + at, qMin(chunk, mappedLength - at), MSG_NOSIGNAL);
+        }
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN) {
+            if (!writable) {
+                writable = new QSocketNotifier(socket, QSocketNotifier::Write, this);
+                connect(writable, SIGNAL(activated(int)), this, SLOT(dataWritable()));
+            }
+            writable->setEnabled(true);
+            break;
+        }
+        if (n < 0) {
+            qWarning() << "FtpWorker" << "upload failed:" << strerror(errno);
+            op->position = size;
+            data->abort();
+            return true;
+        }
+        if (n == 0)
+            break; // the file shrank
+        op->position += n;
+        op->done += n;
+        sent += n;
+    }
+
+    if (op->position >= size) {
+        releaseDirect();
+        data->disconnectFromHost();
+    }
+    if (sent)
+        progress(op);
+    return true;
+#else
+    Q_UNUSED(op);
+    return false;
+#endif
+}
+
+void FtpWorker::releaseDirect()
+{
+#ifdef Q_OS_LINUX
+    if (mapped)
+        ::munmap(mapped, mappedLength);
+#endif
+    mapped = 0;
+    mappedLength = 0;
+    if (writable) {
+        // May be called from its own activated() signal.
+        writable->setEnabled(false);
+        writable->deleteLater();
+        writable = 0;
+    }
+}
+
+/*!
+    Returns true if the server announced MODE Z in its FEAT reply.
+ */
+bool FtpWorker::offersDeflate() const
+{
+    return features.value("MODE").toUpper().contains('Z');
+}
+
+/*!
+    Sets up the deflate stream of the upload \a op, or the inflate
+    stream of the download \a op.
+ */
+void FtpWorker::startZlib(Operation *op)
+{
+    endZlib();
+    zstream = new z_stream;
+    memset(zstream, 0, sizeof(z_stream));
+    zstreamOut = op->type == QFtp::Put;
+    int ret = zstreamOut ? deflateInit(zstream, op->level) : inflateInit(zstream);
+    if (ret != Z_OK) {
+        qWarning() << "FtpWorker" << "zlib:" << ret;
+        delete zstream;
+        zstream = 0;
+    }
+}
+
+void FtpWorker::endZlib()
+{
+    if (!zstream)
+        return;
+    if (zstreamOut)
+        deflateEnd(zstream);
+    else
+        inflateEnd(zstream);
+    delete zstream;
+    zstream = 0;
+}
+
+/*!
+    Feeds the upload \a op into the data connection deflated, like
+    writeData(). The stream is finished and ended at the end of the
+    device, after which the connection is closed.
+ */
+void FtpWorker::writeCompressed(Operation *op)
+{
+    QByteArray out;
+    out.resize(UploadChunk);
+    while (zstream && data->bytesToWrite() < UploadChunk) {
+        QByteArray chunk = op->device->read(UploadChunk);
+        int flush = op->device->atEnd() ? Z_FINISH : Z_NO_FLUSH;
+        if (chunk.isEmpty() && flush != Z_FINISH)
+            break;
+        zstream->next_in = reinterpret_cast<Bytef*>(chunk.data());
+        zstream->avail_in = chunk.size();
+        int ret;
+        do {
+            zstream->next_out = reinterpret_cast<Bytef*>(out.data());
+            zstream->avail_out = out.size();
+            ret = ::deflate(zstream, flush);
+            data->write(out.constData(), out.size() - zstream->avail_out);
+        } while (zstream->avail_out == 0 && ret != Z_STREAM_END);
+        op->done += chunk.size();
+        progress(op);
+        if (ret == Z_STREAM_END)
+            endZlib();
+    }
+    if (!zstream && data->bytesToWrite() == 0)
+        data->disconnectFromHost();
+}
+
+/*!
+    Replaces \a bytes, as received for a compressed download, by what
+    they inflate to. Whatever follows the end of the stream is dropped.
+    Returns false if the data is not a valid deflate stream.
+ */
+bool FtpWorker::inflateData(QByteArray *bytes)
+{
+    if (!zstream) {
+        bytes->clear();
+        return true;
+    }
+    QByteArray out;
+    QByteArray buffer;
+    buffer.resize(InflateChunk);
+    zstream->next_in = reinterpret_cast<Bytef*>(bytes->data());
+    zstream->avail_in = bytes->size();
+    for (;;) {
+        zstream->next_out = reinterpret_cast<Bytef*>(buffer.data());
+        zstream->avail_out = buffer.size();
+        int ret = ::inflate(zstream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+            return false;
+        out.append(buffer.constData(), buffer.size() - zstream->avail_out);
+        if (ret == Z_STREAM_END) {
+            endZlib();
+            break;
+        }
+        if (zstream->avail_out != 0)
+            break;
+    }
+    *bytes = out;
+    return true;
+}
+
+/*!
+    Switches the server back to stream mode where a compressed transfer
+    was dropped before it could, so the next transfer is not taken for
+    compressed.
+ */
+void FtpWorker::restoreMode()
+{
+    compressing = 0;
+    if (control->state() != QAbstractSocket::ConnectedState)
+        return;
+    Step *s = new Step;
+    s->line = "MODE S";
+    qDebug() << "ftp >" << s->line;
+    control->write(s->line + "\r\n");
+    inFlight.enqueue(s);
+}
+
+void FtpWorker::dataWritable()
+{
+    writable->setEnabled(false);
+    if (transfer && transfer->op->type == QFtp::Put)
+        writeData();
+}
+
+void FtpWorker::dataReadyRead()
+{
+    if (!transfer || sender() != data)
+        return; // RETR or LIST is not out yet
+
+    Operation *op = transfer->op;
+    if (op->type == QFtp::List) {
+        listBuffer += data->readAll();
+        readListing(false);
+        return;
+    }
+    QByteArray bytes = data->readAll();
+    if (op->deflate && !inflateData(&bytes)) {
+        abortCurrent(tr("Corrupt compressed data"));
+        return;
+    }
+    // Offsets and lengths count the file's bytes, compressed or not.
+    if (op->length >= 0 && op->done + bytes.size() > op->length)
+        bytes.truncate(op->length - op->done);
+    if (op->device && op->device->write(bytes) != bytes.size()) {
+        abortCurrent(op->device->errorString());
+        return;
+    }
+    op->done += bytes.size();
+    if (op->length >= 0 && op->done >= op->length && !transfer->replied) {
+        // The rest belongs to somebody else.
+        progress(op, true);
+        abortCurrent(QString(), false);
+        return;
+    }
+    progress(op);
+}
+
+/*!
+    Reports the progress of \a op, at most every 100 ms unless \a force
+    is true, so a fast transfer does not flood the receiving thread.
+ */
+void FtpWorker::progress(Operation *op, bool force)
+{
+    if (!force && progressClock.isValid() && progressClock.elapsed() < 100
+        && op->done != op->total)
+        return;
+    progressClock.start();
+    emit dataTransferProgress(op->done, op->total);
+}
+
+void FtpWorker::dataBytesWritten()
+{
+    if (sender() == data && transfer && transfer->op->type == QFtp::Put)
+        writeData();
+}
+
+void FtpWorker::dataDisconnected()
+{
+    if (sender() == standby) {
+        closeStandby();
+        return;
+    }
+    if (sender() != data)
+        return;
+    if (!transfer) {
+        // An idle connection timed out before it was used.
+        closeData();
+        schedulePump();
+        return;
+    }
+    dataReadyRead();
+    if (!transfer)
+        return;
+    if (transfer->op->type == QFtp::List)
+        readListing(true);
+    if (transfer->op->type == QFtp::Get && transfer->op->deflate && zstream) {
+        abortCurrent(tr("Compressed data ended early"));
+        return;
+    }
+    transfer->dataDone = true;
+    if (transfer->replied)
+        finishTransfer();
+}
+
+void FtpWorker::dataError()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket*>(sender());
+    if (!socket || socket->error() == QAbstractSocket::RemoteHostClosedError)
+        return; // dataDisconnected() follows
+    qWarning() << "FtpWorker" << socket->errorString();
+    if (socket == standby) {
+        closeStandby();
+        return;
+    }
+    if (socket != data)
+        return;
+    QString text = data->errorString();
+    closeData();
+    if (transfer) {
+        Operation *op = transfer->op;
+        transfer = 0;
+        lastError = QFtp::UnknownError;
+        lastErrorString = text;
+        finishOperation(op, true);
+    }
+    schedulePump();
+}
+
+/*!
+    Reports the complete lines of the listing received so far, all of it
+    if \a flush is true.
+ */
+void FtpWorker::readListing(bool flush)
+{
+    // Lines are parsed where they are in the buffer, without copies.
+    bool machine = transfer->op->machine;
+    FtpListing infos;
+    const char *begin = listBuffer.constData();
+    const char *end = begin + listBuffer.size();
+    const char *line = begin;
+    while (line < end) {
+        const char *nl = static_cast<const char*>(memchr(line, '\n', end - line));
+        if (!nl && !flush)
+            break;
+        const char *stop = nl ? nl : end;
+        if (stop > line && stop[-1] == '\r')
+            --stop;
+        QUrlInfo info;
+        if (machine ? parseFactsLine(line, stop, &info)
+                    : parseListLine(line, stop, &info))
+            infos.append(info);
+        line = nl ? nl + 1 : end;
+    }
+    listBuffer.remove(0, line - begin);
+    if (!infos.isEmpty())
+        emit listInfos(transfer->op->id, infos);
+}
+
+/*!
+    Takes note of the extensions announced in the FEAT reply \a text,
+    one per line indented by a space, with their parameters.
+ */
+void FtpWorker::readFeatures(const QByteArray &text)
+{
+    features.clear();
+    foreach (const QByteArray &line, text.split('\n')) {
+        if (!line.startsWith(' '))
+            continue;
+        QByteArray feature = line.trimmed();
+        int space = feature.indexOf(' ');
+        QByteArray name = feature.left(space < 0 ? feature.size() : space).toUpper();
+        features.insert(name, space < 0 ? QByteArray() : feature.mid(space + 1));
+    }
+    // Each name with its parameters, if any.
+    QStringList announced;
+    QHash<QByteArray, QByteArray>::const_iterator i;
+    for (i = features.constBegin(); i != features.constEnd(); ++i)
+        announced.append(QString::fromLatin1(i.value().isEmpty() ? i.key() : i.key() + ' ' + i.value()));
+    emit featuresChanged(announced);
+}
+
+/*!
+    Reports the entry in the MLST reply \a text of operation \a id, whose
+    fact line is indented by a space.
+ */
+void FtpWorker::readFacts(int id, const QByteArray &text)
+{
+    FtpListing infos;
+    foreach (const QByteArray &line, text.split('\n')) {
+        QUrlInfo info;
+        if (line.startsWith(' ')
+            && parseFactsLine(line.constData() + 1, line.constData() + line.size(), &info, false))
+            infos.append(info);
+    }
+    if (!infos.isEmpty())
+        emit listInfos(id, infos);
+}
+
+void FtpWorker::setState(QFtp::State state)
+{
+    if (state == currentState)
+        return;
+    currentState = state;
+    emit stateChanged(state);
+}
+
+QByteArray FtpWorker::encodePath(const QString &path)
+{
+    return path.toUtf8();
+}
+
+static inline qint64 parseDigits(const char *begin, const char *end, int base = 10)
+{
+    qint64 value = 0;
+    for (const char *p = begin; p < end && *p >= '0' && *p < '0' + base; ++p)
+        value = value * base + (*p - '0');
+    return value;
+}
+
+static int monthFromName(const char *name, int size)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    if (size != 3)
+        return 0;
+    for (int i = 0; i < 12; ++i) {
+        if (qstrnicmp(name, months + i * 3, 3) == 0)
+            return i + 1;
+    }
+    return 0;
+}
+
+// A run of non-blank characters of a LIST line.
+struct Field {
+    const char *begin;
+    const char *end;
+    int size() const { return end - begin; }
+    bool is(const char *text) const {
+        return int(qstrlen(text)) == size() && qstrncmp(begin, text, size()) == 0;
+    }
+};
+
+static inline bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool isDigits(const char *begin, const char *end, int min, int max)
+{
+    if (end - begin < min || end - begin > max)
+        return false;
+    for (const char *p = begin; p < end; ++p) {
+        if (*p < '0' || *p > '9')
+            return false;
+    }
+    return true;
+}
+
+/*!
+    Splits the line between \a begin and \a end into at most \a max
+    \a fields. Returns how many there are.
+ */
+static int splitFields(const char *begin, const char *end, Field *fields, int max)
+{
+    int count = 0;
+    const char *p = begin;
+    while (count < max) {
+        while (p < end && isBlank(*p))
+            ++p;
+        if (p == end)
+            break;
+        fields[count].begin = p;
+        while (p < end && !isBlank(*p))
+            ++p;
+        fields[count].end = p;
+        ++count;
+    }
+    return count;
+}
+
+/*!
+    Parses one line of a LIST reply in Unix or in DOS format, between
+    \a begin and \a end, into \a info. The fields are looked at where
+    they are; only the strings kept in \a info are made. Returns false
+    for lines which are no entries.
+ */
+bool parseListLine(const char *begin, const char *end, QUrlInfo *info)
+{
+    // The mode, up to seven fields and the first word of the name.
+    Field fields[9];
+    int count = splitFields(begin, end, fields, 9);
+    if (count == 0)
+        return false;
+
+    const Field &mode = fields[0];
+    bool isUnix = mode.size() >= 10 && memchr("-dlcbps", mode.begin[0], 7);
+    for (int i = 1; isUnix && i < 10; ++i)
+        isUnix = memchr("rwxsStTl-", mode.begin[i], 9) != 0;
+    if (isUnix) {
+        // "mode links owner [group] size month day time|year name"; the
+        // group is left out by some servers.
+        int first = 0;
+        for (int group = 1; group >= 0 && !first; --group) {
+            int f = 3 + group;
+            if (count < f + 5 || !isDigits(fields[1].begin, fields[1].end, 1, 20)
+                || !isDigits(fields[f].begin, fields[f].end, 1, 20)
+                || !isDigits(fields[f + 2].begin, fields[f + 2].end, 1, 2))
+                continue;
+            const Field &time = fields[f + 3];
+            const char *colon = static_cast<const char*>(memchr(time.begin, ':', time.size()));
+            if (colon ? !isDigits(time.begin, colon, 1, 2) || !isDigits(colon + 1, time.end, 2, 2)
+                      : !isDigits(time.begin, time.end, 4, 4))
+                continue;
+            first = f;
+        }
+        if (!first)
+            return false;
+        char type = mode.begin[0];
+        const Field &size = fields[first];
+        const Field &monthName = fields[first + 1];
+        const Field &time = fields[first + 3];
+        const char *nameEnd = end;
+        if (type == 'l') {
+            for (const char *p = fields[first + 4].begin; p + 4 <= end; ++p) {
+                if (qstrncmp(p, " -> ", 4) == 0) {
+                    nameEnd = p;
+                    break;
+                }
+            }
+        }
+
+        int permissions = 0;
+        static const int bits[9] = {
+            QUrlInfo::ReadOwner, QUrlInfo::WriteOwner, QUrlInfo::ExeOwner,
+            QUrlInfo::ReadGroup, QUrlInfo::WriteGroup, QUrlInfo::ExeGroup,
+            QUrlInfo::ReadOther, QUrlInfo::WriteOther, QUrlInfo::ExeOther
+        };
+        for (int i = 0; i < 9; ++i) {
+            char c = mode.begin[i + 1];
+            if (c != '-' && c != 'S' && c != 'T')
+                permissions |= bits[i];
+        }
+
+        int month = monthFromName(monthName.begin, monthName.size());
+        int day = parseDigits(fields[first + 2].begin, fields[first + 2].end);
+        const char *colon = static_cast<const char*>(memchr(time.begin, ':', time.size()));
+        QDateTime modified;
+        if (colon) {
+            QDate today = QDate::currentDate();
+            QDate date(today.year(), month, day);
+            if (date > today.addDays(1))
+                date = date.addYears(-1);
+            modified = QDateTime(date, QTime(parseDigits(time.begin, colon),
+                                             parseDigits(colon + 1, time.end)));
+        } else {
+            modified = QDateTime(QDate(parseDigits(time.begin, time.end), month, day));
+        }
+
+        const char *name = fields[first + 4].begin;
+        info->setName(QString::fromUtf8(name, nameEnd - name));
+        info->setDir(type == 'd');
+        info->setFile(type != 'd' && type != 'l');
+        info->setSymLink(type == 'l');
+        info->setOwner(QString::fromUtf8(fields[2].begin, fields[2].size()));
+        info->setGroup(first == 4 ? QString::fromUtf8(fields[3].begin, fields[3].size()) : QString());
+        info->setSize(parseDigits(size.begin, size.end));
+        info->setLastModified(modified);
+        info->setPermissions(permissions);
+        info->setReadable(permissions & (QUrlInfo::ReadOwner | QUrlInfo::ReadGroup | QUrlInfo::ReadOther));
+        info->setWritable(permissions & QUrlInfo::WriteOwner);
+        return true;
+    }
+
+    // "MM-DD-YY[YY] HH:MM(AM|PM) <DIR>|size name"
+    if (count < 4)
+        return false;
+    const Field &date = fields[0];
+    const Field &time = fields[1];
+    const Field &size = fields[2];
+    const char *d = date.begin;
+    if (date.size() < 8 || !isDigits(d, d + 2, 2, 2) || d[2] != '-'
+        || !isDigits(d + 3, d + 5, 2, 2) || d[5] != '-' || !isDigits(d + 6, date.end, 2, 4))
+        return false;
+    const char *colon = static_cast<const char*>(memchr(time.begin, ':', time.size()));
+    if (!colon || time.end - colon != 5 || !isDigits(time.begin, colon, 1, 2)
+        || !isDigits(colon + 1, colon + 3, 2, 2)
+        || (colon[3] != 'A' && colon[3] != 'P') || colon[4] != 'M')
+        return false;
+    bool isDir = size.is("<DIR>");
+    if (!isDir && !isDigits(size.begin, size.end, 1, 20))
+        return false;
+
+    int year = parseDigits(d + 6, date.end);
+    if (year < 100)
+        year += (year < 70) ? 2000 : 1900;
+    int hour = parseDigits(time.begin, colon) % 12;
+    if (colon[3] == 'P')
+        hour += 12;
+    QDate day(year, parseDigits(d, d + 2), parseDigits(d + 3, d + 5));
+
+    const char *name = fields[3].begin;
+    info->setName(QString::fromUtf8(name, end - name));
+    info->setDir(isDir);
+    info->setFile(!isDir);
+    info->setSymLink(false);
+    info->setSize(isDir ? 0 : parseDigits(size.begin, size.end));
+    info->setLastModified(QDateTime(day, QTime(hour, parseDigits(colon + 1, colon + 3))));
+    info->setPermissions(QUrlInfo::ReadOwner | QUrlInfo::WriteOwner
+                         | (isDir ? QUrlInfo::ExeOwner : 0));
+    info->setReadable(true);
+    info->setWritable(true);
+    return true;
+}
+
+static inline bool factIs(const char *name, const char *nameEnd, const char *fact)
+{
+    int size = nameEnd - name;
+    return int(qstrlen(fact)) == size && qstrnicmp(name, fact, size) == 0;
+}
+
+/*!
+    Parses one line of a MLSD or MLST reply, between \a begin and \a end,
+    into \a info. A line is a list of "fact=value;" pairs followed by a
+    space and the name. The facts are looked at where they are; only the
+    strings kept in \a info are made. Returns false for lines which are
+    no entries and, when \a listing, for the entries of the listed
+    directory itself and its parent.
+ */
+bool parseFactsLine(const char *begin, const char *end, QUrlInfo *info, bool listing)
+{
+    const char *space = static_cast<const char*>(memchr(begin, ' ', end - begin));
+    if (!space || space + 1 >= end)
+        return false;
+
+    bool isDir = false;
+    bool isLink = false;
+    bool haveType = false;
+    int permissions = -1;
+    bool readable = false;
+    bool writable = false;
+    bool executable = false;
+    bool havePerm = false;
+    QDateTime modified;
+    qint64 size = 0;
+    QString owner;
+    QString group;
+
+    const char *fact = begin;
+    while (fact < space) {
+        const char *semicolon = static_cast<const char*>(memchr(fact, ';', space - fact));
+        if (!semicolon)
+            semicolon = space;
+        const char *equals = static_cast<const char*>(memchr(fact, '=', semicolon - fact));
+        if (equals) {
+            const char *value = equals + 1;
+            int valueSize = semicolon - value;
+            if (factIs(fact, equals, "type")) {
+                haveType = true;
+                if ((valueSize == 4 && qstrnicmp(value, "cdir", 4) == 0)
+                    || (valueSize == 4 && qstrnicmp(value, "pdir", 4) == 0)) {
+                    if (listing)
+                        return false;
+                    isDir = true;
+                } else if (valueSize == 3 && qstrnicmp(value, "dir", 3) == 0) {
+                    isDir = true;
+                } else if (valueSize >= 13 && qstrnicmp(value, "OS.unix=slink", 13) == 0) {
+                    isLink = true;
+                } else if (valueSize >= 15 && qstrnicmp(value, "OS.unix=symlink", 15) == 0) {
+                    isLink = true;
+                }
+            } else if (factIs(fact, equals, "size") || factIs(fact, equals, "sizd")) {
+                size = parseDigits(value, semicolon);
+            } else if (factIs(fact, equals, "modify") && valueSize >= 14) {
+                // YYYYMMDDHHMMSS[.sss], always UTC
+                QDate date(parseDigits(value, value + 4), parseDigits(value + 4, value + 6),
+                           parseDigits(value + 6, value + 8));
+                QTime time(parseDigits(value + 8, value + 10), parseDigits(value + 10, value + 12),
+                           parseDigits(value + 12, value + 14));
+                modified = QDateTime(date, time, Qt::UTC).toLocalTime();
+            } else if (factIs(fact, equals, "perm")) {
+                havePerm = true;
+                for (const char *p = value; p < semicolon; ++p) {
+                    switch (*p | 0x20) {
+                    case 'r': case 'l': readable = true; break;
+                    case 'w': case 'a': case 'c': case 'm': case 'p': writable = true; break;
+                    case 'e': executable = true; break;
+                    }
+                }
+            } else if (factIs(fact, equals, "unix.mode")) {
+                permissions = parseDigits(value, semicolon, 8) & 0777;
+            } else if (factIs(fact, equals, "unix.owner")
+                       || (owner.isEmpty() && factIs(fact, equals, "unix.uid"))) {
+                owner = QString::fromUtf8(value, valueSize);
+            } else if (factIs(fact, equals, "unix.group")
+                       || (group.isEmpty() && factIs(fact, equals, "unix.gid"))) {
+                group = QString::fromUtf8(value, valueSize);
+            }
+        }
+        fact = semicolon + 1;
+    }
+    if (!haveType)
+        return false;
+
+    // unix.mode uses the same bits as QUrlInfo::PermissionSpec.
+    if (permissions < 0) {
+        permissions = (readable ? QUrlInfo::ReadOwner : 0) | (writable ? QUrlInfo::WriteOwner : 0)
+                | (executable ? QUrlInfo::ExeOwner : 0);
+    } else if (!havePerm) {
+        readable = permissions & (QUrlInfo::ReadOwner | QUrlInfo::ReadGroup | QUrlInfo::ReadOther);
+        writable = permissions & QUrlInfo::WriteOwner;
+        executable = permissions & QUrlInfo::ExeOwner;
+    }
+
+    info->setName(QString::fromUtf8(space + 1, end - space - 1));
+    info->setDir(isDir);
+    info->setFile(!isDir && !isLink);
+    info->setSymLink(isLink);
+    info->setOwner(owner);
+    info->setGroup(group);
+    info->setSize(isDir ? 0 : size);
+    info->setLastModified(modified);
+    info->setPermissions(permissions);
+    info->setReadable(readable);
+    info->setWritable(writable);
+    info->setExecutable(executable);
+    return true;
+}
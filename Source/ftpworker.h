@@ -0,0 +1,202 @@
+#ifndef FTPWORKER_H
+#define FTPWORKER_H
+
+#include <qobject.h>
+#include <qftp.h>
+#include <qurlinfo.h>
+#include <qlist.h>
+#include <qqueue.h>
+#include <qhash.h>
+#include <qstringlist.h>
+#include <qmutex.h>
+#include <qdatetime.h>
+#include <qmetatype.h>
+
+class QTcpSocket;
+class QIODevice;
+class QSocketNotifier;
+struct z_stream_s;
+
+typedef QList<QUrlInfo> FtpListing;
+Q_DECLARE_METATYPE(FtpListing)
+
+class FtpWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum StepKind {
+        Connect,    // no line, waits for the greeting
+        Plain,      // may be pipelined behind other plain steps
+        Barrier,    // needs every earlier reply first
+        User,       // 230 makes the PASS step superfluous
+        Passive,    // opens the data connection
+        Transfer,   // RETR, STOR, LIST; runs over the data connection
+        Quit
+    };
+
+    struct Operation;
+
+    struct Step {
+        Step() : kind(Plain), op(0), optional(false), skipped(false),
+            replied(false), dataDone(false), spare(false), deflate(false) {}
+        StepKind kind;
+        QByteArray line;
+        Operation *op;
+        bool optional;
+        bool skipped;
+        bool replied;
+        bool dataDone;
+        bool spare;         // PASV sent ahead for a transfer not queued yet
+        bool deflate;       // switches MODE Z on or off, if the server has it
+    };
+
+    enum SendMode {
+        Undecided,
+        SendFile,   // sendfile() from the file to the socket
+        Mapped,     // send() straight from an mmap'd window of the file
+        Buffered    // through QIODevice and QTcpSocket
+    };
+
+    struct Operation {
+        Operation() : id(0), type(QFtp::None), port(21), device(0), offset(0), length(-1),
+            done(0), total(-1), started(false), announced(false), next(0), mode(Undecided),
+            position(0), machine(false), level(0), deflate(false) {}
+        ~Operation() { qDeleteAll(steps); }
+        int id;
+        QFtp::Command type;
+        QList<Step*> steps;
+        QString host;
+        quint16 port;
+        QIODevice *device;
+        qint64 offset;
+        qint64 length;      // a download stops after this many bytes
+        qint64 done;
+        qint64 total;
+        bool started;       // a step has been sent
+        bool announced;     // commandStarted() has been emitted
+        int next;
+        SendMode mode;
+        qint64 position;
+        bool machine;       // listed with MLSD
+        int level;          // of the compression of an upload
+        bool deflate;       // the server took MODE Z for this transfer
+    };
+
+    FtpWorker(QObject *parent = 0);
+    ~FtpWorker();
+
+    void post(Operation *op);
+
+    static Step *step(Operation *op, StepKind kind, const QByteArray &line = QByteArray());
+    static QByteArray encodePath(const QString &path);
+
+public slots:
+    void abort();
+    void clearPendingCommands();
+    void setPipelineDepth(int depth);
+    void setPrenegotiation(bool enabled);
+    void setZeroCopy(bool enabled);
+    void shutdown();
+
+signals:
+    void stateChanged(int state);
+    void featuresChanged(const QStringList &features);
+    void listInfos(int id, const FtpListing &infos);
+    void dataTransferProgress(qint64 done, qint64 total);
+    void rawCommandReply(int replyCode, const QString &detail);
+    void commandStarted(int id);
+    void commandFinished(int id, bool error, int code, int reply, const QString &text,
+                         int dropped);
+
+private slots:
+    void takePosted();
+    void pump();
+    void controlConnected();
+    void controlReadyRead();
+    void controlDisconnected();
+    void controlError();
+    void controlStateChanged();
+    void dataConnected();
+    void dataReadyRead();
+    void dataBytesWritten();
+    void dataDisconnected();
+    void dataError();
+    void dataWritable();
+
+private:
+    QTcpSocket *control;
+    QTcpSocket *data;
+    QTcpSocket *standby;    // data connection of the next transfer
+
+    QMutex postMutex;
+    QList<Operation*> posted;
+    QList<Operation*> operations;
+    QQueue<Step*> inFlight;
+    Step *transfer;
+    int aborting;
+    int lastTaken;
+
+    QFtp::State currentState;
+    QFtp::Error lastError;
+    QString lastErrorString;
+    int lastReply;          // code of the reply that failed the operation
+    int depth;
+    bool pumpScheduled;
+    bool prepare;
+    bool direct;
+    QSocketNotifier *writable;
+    uchar *mapped;
+    qint64 mappedStart;
+    qint64 mappedLength;
+    QTime progressClock;
+    z_stream_s *zstream;
+    bool zstreamOut;        // deflating an upload rather than inflating
+    Operation *compressing; // whose MODE Z went out, until its MODE S does
+
+    QByteArray lineBuffer;
+    int replyCode;
+    QByteArray replyText;
+    QByteArray listBuffer;
+    QHash<QByteArray, QByteArray> features;
+
+    void schedulePump();
+    Step *nextStep() const;
+    bool canSend(const Step *s) const;
+    void send(Step *s);
+    bool hasSpareChannel() const;
+    bool sparePending() const;
+    void prepareChannel();
+
+    void handleReply(int code, const QByteArray &text);
+    void succeeded(Step *s, int code, const QByteArray &text);
+    void failed(Step *s, int code, const QByteArray &text);
+    void advance(Operation *op);
+    void announce();
+    void finishTransfer();
+    void finishOperation(Operation *op, bool error);
+    void failAll(QFtp::Error error, const QString &text);
+    void abortCurrent(const QString &reason, bool error = true);
+    void openData(const QByteArray &text);
+    void closeData();
+    void closeStandby();
+    void writeData();
+    bool sendDirect(Operation *op);
+    void releaseDirect();
+    bool offersDeflate() const;
+    void startZlib(Operation *op);
+    void endZlib();
+    void writeCompressed(Operation *op);
+    bool inflateData(QByteArray *bytes);
+    void restoreMode();
+    void progress(Operation *op, bool force = false);
+    void readListing(bool flush);
+    void readFeatures(const QByteArray &text);
+    void readFacts(int id, const QByteArray &text);
+    void setState(QFtp::State state);
+};
+
+bool parseListLine(const char *begin, const char *end, QUrlInfo *info);
+bool parseFactsLine(const char *begin, const char *end, QUrlInfo *info, bool listing = true);
+
+#endif // FTPWORKER_H
@@ -0,0 +1,315 @@
+#include "listingcache.h"
+
+#include <qdatastream.h>
+#include <qdatetime.h>
+#include <qdir.h>
+#include <qfileinfo.h>
+#include <qstringlist.h>
+#include <qdebug.h>
+
+#include <stdio.h>
+
+static const quint32 CacheMagic = 0x46544c31; // "FTL1"
+
+enum EntryFlag {
+    DirFlag = 1,
+    FileFlag = 2,
+    SymLinkFlag = 4,
+    WritableFlag = 8,
+    ReadableFlag = 16,
+    ExecutableFlag = 32
+};
+
+/*!
+    \class ListingCache listingcache.h
+
+    \brief The ListingCache class keeps the directory listings of the
+    servers visited on disk, so a tree shows up right away after a
+    reconnect or a restart.
+
+    Listings are keyed by user, host, port and path and expire after
+    timeToLive() seconds. The file is mapped into memory when it is
+    loaded: a listing is decoded only when it is asked for, and listings
+    which did not change are written back from the mapping as they are.
+    Besides the listings the cache remembers which directories were
+    expanded on each server.
+
+    Changes are written to disk at most once a second and the file is
+    replaced atomically.
+
+    \sa FtpModel
+*/
+
+ListingCache::ListingCache(const QString &fileName, QObject *parent)
+    : QObject(parent), path(fileName), ttl(24 * 60 * 60), map(0)
+{
+    syncTimer.setSingleShot(true);
+    syncTimer.setInterval(1000);
+    connect(&syncTimer, SIGNAL(timeout()), this, SLOT(sync()));
+    load();
+}
+
+ListingCache::~ListingCache()
+{
+    if (syncTimer.isActive())
+        sync();
+    records.clear();
+    contents.clear();
+    if (map)
+        file.unmap(map);
+}
+
+/*!
+    Selects the server and user of \a url for all further calls.
+ */
+void ListingCache::setServer(const QUrl &url)
+{
+    server = QString("%1@%2:%3").arg(url.userName()).arg(url.host()).arg(url.port(21));
+}
+
+/*!
+    Returns the number of seconds a listing is used for, 0 if the cache
+    is disabled.
+ */
+int ListingCache::timeToLive() const
+{
+    return ttl;
+}
+
+void ListingCache::setTimeToLive(int secs)
+{
+    ttl = qMax(0, secs);
+}
+
+/*!
+    Returns true if there is a listing of \a path which has not expired.
+ */
+bool ListingCache::contains(const QString &path) const
+{
+    QHash<QString, Record>::const_iterator it = records.constFind(key(path));
+    return it != records.constEnd() && isFresh(it.value());
+}
+
+/*!
+    Returns the listing of \a path, empty if there is none or it expired.
+ */
+FtpListing ListingCache::listing(const QString &path) const
+{
+    FtpListing infos;
+    QHash<QString, Record>::const_iterator it = records.constFind(key(path));
+    if (it == records.constEnd() || !isFresh(it.value()))
+        return infos;
+
+    QDataStream in(it->data);
+    quint32 count;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString name, owner, group;
+        qint64 size;
+        quint32 modified;
+        qint32 permissions;
+        quint8 flags;
+        in >> name >> size >> modified >> permissions >> flags >> owner >> group;
+        QDateTime time = modified ? QDateTime::fromTime_t(modified) : QDateTime();
+        infos.append(QUrlInfo(name, permissions, owner, group, size, time, time,
+                              flags & DirFlag, flags & FileFlag, flags & SymLinkFlag,
+                              flags & WritableFlag, flags & ReadableFlag, flags & ExecutableFlag));
+    }
+    return infos;
+}
+
+/*!
+    Stores \a infos as the listing of \a path.
+ */
+void ListingCache::store(const QString &path, const FtpListing &infos)
+{
+    if (ttl <= 0 || server.isEmpty())
+        return;
+    Record record;
+    record.stored = QDateTime::currentDateTime().toTime_t();
+    QDataStream out(&record.data, QIODevice::WriteOnly);
+    out << quint32(infos.count());
+    foreach (const QUrlInfo &info, infos) {
+        quint8 flags = (info.isDir() ? DirFlag : 0) | (info.isFile() ? FileFlag : 0)
+                | (info.isSymLink() ? SymLinkFlag : 0) | (info.isWritable() ? WritableFlag : 0)
+                | (info.isReadable() ? ReadableFlag : 0)
+                | (info.isExecutable() ? ExecutableFlag : 0);
+        quint32 modified = info.lastModified().isValid() ? info.lastModified().toTime_t() : 0;
+        out << info.name() << info.size() << modified << qint32(info.permissions()) << flags
+            << info.owner() << info.group();
+    }
+    records.insert(key(path), record);
+    scheduleSync();
+}
+
+void ListingCache::remove(const QString &path)
+{
+    if (records.remove(key(path)))
+        scheduleSync();
+}
+
+/*!
+    Returns the directories of the current server which were expanded,
+    parents before their children.
+ */
+QStringList ListingCache::expanded() const
+{
+    QStringList paths = expandedPaths.value(server).toList();
+    qSort(paths);
+    return paths;
+}
+
+void ListingCache::setExpanded(const QString &path, bool expanded)
+{
+    if (ttl <= 0 || server.isEmpty())
+        return;
+    QSet<QString> &paths = expandedPaths[server];
+    if (expanded == paths.contains(path))
+        return;
+    if (expanded)
+        paths.insert(path);
+    else
+        paths.remove(path);
+    scheduleSync();
+}
+
+/*!
+    Writes the cache to disk now, leaving out expired listings.
+ */
+void ListingCache::sync()
+{
+    syncTimer.stop();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QFile out(path + ".new");
+    if (!out.open(QIODevice::WriteOnly)) {
+        qWarning() << "ListingCache" << out.errorString();
+        return;
+    }
+    QList<QString> keys;
+    for (QHash<QString, Record>::const_iterator it = records.constBegin();
+         it != records.constEnd(); ++it) {
+        if (isFresh(it.value()))
+            keys.append(it.key());
+    }
+    QDataStream stream(&out);
+    stream << CacheMagic << quint32(keys.count());
+    foreach (const QString &k, keys) {
+        const Record &record = records[k];
+        stream << k << quint32(record.stored) << quint32(record.data.size());
+        stream.writeRawData(record.data.constData(), record.data.size());
+    }
+    stream << quint32(expandedPaths.count());
+    for (QHash<QString, QSet<QString> >::const_iterator it = expandedPaths.constBegin();
+         it != expandedPaths.constEnd(); ++it)
+        stream << it.key() << QStringList(it.value().toList());
+    out.close();
+
+    if (!replace(out.fileName())) {
+        // The listings stay in memory and are written again next time.
+        qWarning() << "ListingCache" << "cannot replace" << path;
+        QFile::remove(out.fileName());
+        return;
+    }
+    records.clear();
+    expandedPaths.clear();
+    release();
+    load();
+}
+
+/*!
+    Moves the file \a fileName over the cache file. The old file stays
+    where it is until it is replaced. Returns false if it could not be
+    replaced.
+ */
+bool ListingCache::replace(const QString &fileName)
+{
+#ifdef Q_OS_UNIX
+    // Atomic, and the old file stays mapped until released.
+    return ::rename(QFile::encodeName(fileName).constData(),
+                    QFile::encodeName(path).constData()) == 0;
+#else
+    // A mapped file cannot be replaced here, so the records are copied
+    // out of the mapping first.
+    for (QHash<QString, Record>::iterator it = records.begin(); it != records.end(); ++it)
+        it->data = QByteArray(it->data.constData(), it->data.size());
+    release();
+    if (QFile::exists(path) && !QFile::rename(path, path + ".old"))
+        return false;
+    if (!QFile::rename(fileName, path)) {
+        QFile::rename(path + ".old", path);
+        return false;
+    }
+    QFile::remove(path + ".old");
+    return true;
+#endif
+}
+
+/*!
+    Unmaps and closes the cache file. The records must not point into it
+    any more.
+ */
+void ListingCache::release()
+{
+    contents.clear();
+    if (map)
+        file.unmap(map);
+    map = 0;
+    file.close();
+}
+
+QString ListingCache::key(const QString &path) const
+{
+    return server + '|' + path;
+}
+
+bool ListingCache::isFresh(const Record &record) const
+{
+    return ttl > 0 && QDateTime::currentDateTime().toTime_t() - record.stored < uint(ttl);
+}
+
+void ListingCache::load()
+{
+    file.setFileName(path);
+    if (!file.open(QIODevice::ReadOnly) || file.size() <= 0)
+        return;
+    map = file.map(0, file.size());
+    if (map)
+        contents = QByteArray::fromRawData(reinterpret_cast<const char*>(map), file.size());
+    else
+        contents = file.readAll();
+
+    QDataStream in(contents);
+    quint32 magic, count;
+    in >> magic >> count;
+    if (magic != CacheMagic)
+        return;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        QString k;
+        quint32 stored, size;
+        in >> k >> stored >> size;
+        qint64 pos = in.device()->pos();
+        if (in.status() != QDataStream::Ok || pos + size > contents.size())
+            break;
+        in.skipRawData(size);
+        Record record;
+        record.stored = stored;
+        record.data = QByteArray::fromRawData(contents.constData() + pos, size);
+        records.insert(k, record);
+    }
+    quint32 servers = 0;
+    in >> servers;
+    for (quint32 i = 0; i < servers && in.status() == QDataStream::Ok; ++i) {
+        QString s;
+        QStringList paths;
+        in >> s >> paths;
+        expandedPaths.insert(s, paths.toSet());
+    }
+    qDebug() << "listings loaded   :" << records.count();
+}
+
+void ListingCache::scheduleSync()
+{
+    if (!syncTimer.isActive())
+        syncTimer.start();
+}
@@ -0,0 +1,62 @@
+#ifndef LISTINGCACHE_H
+#define LISTINGCACHE_H
+
+#include <qobject.h>
+#include <qhash.h>
+#include <qset.h>
+#include <qtimer.h>
+#include <qurl.h>
+#include <qfile.h>
+
+#include "ftpworker.h"
+
+class ListingCache : public QObject
+{
+    Q_OBJECT
+
+public:
+    ListingCache(const QString &fileName, QObject *parent = 0);
+    ~ListingCache();
+
+    void setServer(const QUrl &url);
+
+    int timeToLive() const;
+    void setTimeToLive(int secs);
+
+    bool contains(const QString &path) const;
+    FtpListing listing(const QString &path) const;
+    void store(const QString &path, const FtpListing &infos);
+    void remove(const QString &path);
+
+    QStringList expanded() const;
+    void setExpanded(const QString &path, bool expanded);
+
+public slots:
+    void sync();
+
+private:
+    struct Record {
+        Record() : stored(0) {}
+        uint stored;
+        QByteArray data;    // points into the mapped file until replaced
+    };
+
+    QString path;
+    QString server;
+    int ttl;
+    QFile file;
+    uchar *map;
+    QByteArray contents;    // the mapped file, or a copy where mapping fails
+    QHash<QString, Record> records;
+    QHash<QString, QSet<QString> > expandedPaths;
+    QTimer syncTimer;
+
+    QString key(const QString &path) const;
+    bool isFresh(const Record &record) const;
+    void load();
+    bool replace(const QString &fileName);
+    void release();
+    void scheduleSync();
+};
+
+#endif // LISTINGCACHE_H
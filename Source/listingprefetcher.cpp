@@ -0,0 +1,215 @@
+#include "listingprefetcher.h"
+
+#include <qtimer.h>
+#include <qdebug.h>
+
+// Directories waiting to be listed at most.
+static const int MaxWanted = 1000;
+
+/*!
+    \class ListingPrefetcher listingprefetcher.h
+
+    \brief The ListingPrefetcher class lists directories before the user
+    opens them, on a session of its own.
+
+    FtpModel asks for the directories shown below the expanded ones with
+    want(), each with its level below what the user opened. Up to
+    concurrency() listings are queued at a time, the latest wishes first,
+    and nothing deeper than depth() levels is listed. While the model
+    waits for a listing of its own the prefetcher is held, so it does not
+    compete with what the user asked for.
+
+    The session is opened on the first wish and each finished listing is
+    reported by listed().
+
+    \sa FtpModel
+*/
+
+ListingPrefetcher::ListingPrefetcher(QObject *parent)
+    : QObject(parent), ftp(0), enabled(false), held(false), loggingIn(false),
+    failed(false), maxRunning(2), maxDepth(1)
+{
+}
+
+ListingPrefetcher::~ListingPrefetcher()
+{
+    delete ftp;
+}
+
+/*!
+    Sets the server and the credentials to \a url. What was wanted for
+    another server is dropped.
+ */
+void ListingPrefetcher::setUrl(const QUrl &url)
+{
+    if (url == ftpUrl)
+        return;
+    clear();
+    ftpUrl = url;
+    failed = false;
+}
+
+/*!
+    Returns true if directories are listed ahead. Disabled by default.
+ */
+bool ListingPrefetcher::isEnabled() const
+{
+    return enabled;
+}
+
+void ListingPrefetcher::setEnabled(bool enabled)
+{
+    this->enabled = enabled;
+    if (!enabled)
+        clear();
+}
+
+/*!
+    Returns the number of listings queued on the session at a time.
+ */
+int ListingPrefetcher::concurrency() const
+{
+    return maxRunning;
+}
+
+void ListingPrefetcher::setConcurrency(int listings)
+{
+    maxRunning = qMax(1, listings);
+}
+
+/*!
+    Returns how many levels below an opened directory are listed.
+ */
+int ListingPrefetcher::depth() const
+{
+    return maxDepth;
+}
+
+void ListingPrefetcher::setDepth(int levels)
+{
+    maxDepth = qMax(1, levels);
+}
+
+/*!
+    Asks for the directory \a path, \a level levels below an opened one,
+    to be listed.
+ */
+void ListingPrefetcher::want(const QString &path, int level)
+{
+    if (!enabled || failed || level > maxDepth || known.contains(path))
+        return;
+    known.insert(path);
+    Request request = { path, level };
+    wanted.append(request);
+    if (wanted.count() > MaxWanted)
+        known.remove(wanted.takeFirst().path);
+    QTimer::singleShot(0, this, SLOT(pump()));
+}
+
+/*!
+    Holds new listings back while \a held is true.
+ */
+void ListingPrefetcher::setHeld(bool held)
+{
+    this->held = held;
+    if (!held)
+        QTimer::singleShot(0, this, SLOT(pump()));
+}
+
+/*!
+    Drops all wishes and closes the session.
+ */
+void ListingPrefetcher::clear()
+{
+    wanted.clear();
+    known.clear();
+    running.clear();
+    collected.clear();
+    loggingIn = false;
+    if (ftp) {
+        ftp->disconnect(this);
+        ftp->abort();
+        ftp->close();
+        ftp->deleteLater();
+        ftp = 0;
+    }
+}
+
+void ListingPrefetcher::pump()
+{
+    if (!enabled || held || failed || wanted.isEmpty() || ftpUrl.isEmpty())
+        return;
+    if (!ftp) {
+        ftp = new FtpEngine(this);
+        connect(ftp, SIGNAL(stateChanged(int)), this, SLOT(stateChanged(int)));
+        connect(ftp, SIGNAL(listInfos(int, const FtpListing &)),
+                this, SLOT(listInfos(int, const FtpListing &)));
+        connect(ftp, SIGNAL(commandFinished(int, bool)), this, SLOT(commandFinished(int, bool)));
+    }
+    if (ftp->state() == QFtp::Unconnected && !loggingIn) {
+        loggingIn = true;
+        ftp->connectToHost(ftpUrl.host(), ftpUrl.port(21));
+        ftp->login(ftpUrl.userName(), ftpUrl.password());
+        return;
+    }
+    if (ftp->state() != QFtp::LoggedIn)
+        return;
+    while (running.count() < maxRunning && !wanted.isEmpty()) {
+        Request request = wanted.takeLast();
+        running.insert(ftp->list(request.path), request);
+    }
+}
+
+void ListingPrefetcher::stateChanged(int state)
+{
+    if (state == QFtp::LoggedIn) {
+        loggingIn = false;
+        pump();
+    } else if (state == QFtp::Unconnected) {
+        // What was running is listed again on the next session.
+        loggingIn = false;
+        foreach (const Request &request, running)
+            wanted.append(request);
+        running.clear();
+        collected.clear();
+    }
+}
+
+/*!
+    Collects the entries of the listing \a id. Listings run pipelined on
+    the session, so entries are kept apart by the command they belong to.
+ */
+void ListingPrefetcher::listInfos(int id, const FtpListing &infos)
+{
+    if (running.contains(id))
+        collected[id] += infos;
+}
+
+void ListingPrefetcher::commandFinished(int id, bool error)
+{
+    if (loggingIn && error) {
+        // No session to be had with these credentials.
+        qWarning() << "ListingPrefetcher" << ftp->errorString();
+        failed = true;
+        loggingIn = false;
+        return;
+    }
+    if (!running.contains(id))
+        return;
+    Request request = running.take(id);
+    FtpListing infos = collected.take(id);
+    if (error) {
+        // Only a complete listing is handed on. The failed one may be
+        // wanted again, the error dropped those queued behind it.
+        known.remove(request.path);
+        foreach (const Request &other, running)
+            wanted.append(other);
+        running.clear();
+        collected.clear();
+    } else {
+        // Wanted again once the model forgets the listing.
+        known.remove(request.path);
+        emit listed(request.path, infos, request.level);
+    }
+    pump();
+}
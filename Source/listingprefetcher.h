@@ -0,0 +1,66 @@
+#ifndef LISTINGPREFETCHER_H
+#define LISTINGPREFETCHER_H
+
+#include <qobject.h>
+#include <qlist.h>
+#include <qhash.h>
+#include <qmap.h>
+#include <qset.h>
+#include <qurl.h>
+
+#include "ftpengine.h"
+
+class ListingPrefetcher : public QObject
+{
+    Q_OBJECT
+
+public:
+    ListingPrefetcher(QObject *parent = 0);
+    ~ListingPrefetcher();
+
+    void setUrl(const QUrl &url);
+
+    bool isEnabled() const;
+    void setEnabled(bool enabled);
+    int concurrency() const;
+    void setConcurrency(int listings);
+    int depth() const;
+    void setDepth(int levels);
+
+    void want(const QString &path, int level);
+    void setHeld(bool held);
+
+public slots:
+    void clear();
+
+signals:
+    void listed(const QString &path, const FtpListing &infos, int level);
+
+private slots:
+    void pump();
+    void stateChanged(int state);
+    void listInfos(int id, const FtpListing &infos);
+    void commandFinished(int id, bool error);
+
+private:
+    struct Request {
+        QString path;
+        int level;
+    };
+
+    FtpEngine *ftp;
+    QUrl ftpUrl;
+    bool enabled;
+    bool held;
+    bool loggingIn;
+    bool failed;
+    int maxRunning;
+    int maxDepth;
+
+    QList<Request> wanted;
+    QSet<QString> known;
+    QMap<int, Request> running;
+    QHash<int, FtpListing> collected;   // by command id, until it finishes
+};
+
+#endif // LISTINGPREFETCHER_H
@@ -1,10 +1,21 @@
 #include <QtGui/QApplication>
 #include "window.h"
 
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#endif
+
 
 int main(int argc, char *argv[])
 {
+#ifdef Q_OS_UNIX
+    // A peer closing a data connection must not kill the process;
+    // sendfile() has no MSG_NOSIGNAL.
+    signal(SIGPIPE, SIG_IGN);
+#endif
     QApplication a(argc, argv);
+    a.setOrganizationName("ftpclient");
+    a.setApplicationName("ftpclient");
     window w;
 #if defined(Q_WS_S60)
     w.showMaximized();
@@ -0,0 +1,182 @@
+#include "sessionkeeper.h"
+
+#include <qdebug.h>
+
+/*!
+    \class SessionKeeper sessionkeeper.h
+
+    \brief The SessionKeeper class keeps an ftp session logged in for as
+    long as the user wants it to be.
+
+    An idle session is sent a NOOP every keepAliveInterval() so servers
+    do not time it out. If the server drops the session anyway, the
+    keeper connects and logs in again with the credentials from
+    setUrl(), waiting twice as long after each failed attempt, and
+    emits lost() when maxAttempts() attempts have failed. Only close()
+    ends a session for good.
+
+    \sa FtpModel, TransferPool
+*/
+
+SessionKeeper::SessionKeeper(QObject *parent)
+    : QObject(parent), ftp(0), retry(true), closing(false), loggedIn(false),
+    active(false), attempts(0), attemptLimit(5)
+{
+    idleTimer.setInterval(60 * 1000);
+    idleTimer.setSingleShot(true);
+    connect(&idleTimer, SIGNAL(timeout()), this, SLOT(keepAlive()));
+    retryTimer.setSingleShot(true);
+    connect(&retryTimer, SIGNAL(timeout()), this, SLOT(reconnect()));
+}
+
+/*!
+    Looks after \a ftp from now on.
+ */
+void SessionKeeper::setConnection(FtpEngine *ftp)
+{
+    if (this->ftp)
+        this->ftp->disconnect(this);
+    this->ftp = ftp;
+    connect(ftp, SIGNAL(stateChanged(int)), this, SLOT(stateChanged(int)));
+    connect(ftp, SIGNAL(commandStarted(int)), this, SLOT(activity()));
+    connect(ftp, SIGNAL(commandFinished(int,bool)), this, SLOT(activity()));
+}
+
+/*!
+    Sets the server and the credentials used to reconnect to \a url.
+ */
+void SessionKeeper::setUrl(const QUrl &url)
+{
+    ftpUrl = url;
+    closing = false;
+}
+
+/*!
+    Returns the time in milliseconds a session may be idle before a
+    NOOP is sent. 0 disables keep-alives.
+ */
+int SessionKeeper::keepAliveInterval() const
+{
+    return idleTimer.interval();
+}
+
+void SessionKeeper::setKeepAliveInterval(int msecs)
+{
+    idleTimer.setInterval(msecs);
+    if (msecs <= 0)
+        idleTimer.stop();
+}
+
+/*!
+    Returns true if dropped sessions are reconnected.
+ */
+bool SessionKeeper::reconnectEnabled() const
+{
+    return retry;
+}
+
+void SessionKeeper::setReconnectEnabled(bool enabled)
+{
+    retry = enabled;
+}
+
+int SessionKeeper::maxAttempts() const
+{
+    return attemptLimit;
+}
+
+void SessionKeeper::setMaxAttempts(int attempts)
+{
+    attemptLimit = attempts;
+}
+
+/*!
+    Returns true while a dropped session is being reconnected.
+ */
+bool SessionKeeper::isReconnecting() const
+{
+    return active;
+}
+
+/*!
+    Closes the session without reconnecting.
+ */
+void SessionKeeper::close()
+{
+    closing = true;
+    loggedIn = false;
+    attempts = 0;
+    retryTimer.stop();
+    idleTimer.stop();
+    if (active) {
+        active = false;
+        emit lost();
+    }
+    if (ftp)
+        ftp->close();
+}
+
+void SessionKeeper::stateChanged(int state)
+{
+    switch (state) {
+    case QFtp::LoggedIn:
+        loggedIn = true;
+        attempts = 0;
+        activity();
+        if (active) {
+            qDebug() << "keeper reconnected";
+            active = false;
+            emit reconnected();
+        }
+        break;
+    case QFtp::Unconnected:
+        idleTimer.stop();
+        if (closing || !retry || (!loggedIn && !active))
+            break;
+        loggedIn = false;
+        if (attempts >= attemptLimit) {
+            qWarning() << "SessionKeeper" << "giving up after" << attempts << "attempts";
+            active = false;
+            emit lost();
+            break;
+        }
+        if (!active) {
+            active = true;
+            emit reconnecting();
+        }
+        retryTimer.start(attempts ? (1000 << qMin(attempts, 6)) : 0);
+        break;
+    default:
+        break;
+    }
+}
+
+/*!
+    Restarts the idle period after every command.
+ */
+void SessionKeeper::activity()
+{
+    if (loggedIn && idleTimer.interval() > 0)
+        idleTimer.start();
+}
+
+void SessionKeeper::keepAlive()
+{
+    if (!ftp || ftp->state() != QFtp::LoggedIn)
+        return;
+    if (ftp->hasPendingCommands() || ftp->currentCommand() != QFtp::None) {
+        idleTimer.start();
+        return;
+    }
+    ftp->rawCommand("NOOP");
+}
+
+void SessionKeeper::reconnect()
+{
+    if (!ftp || closing)
+        return;
+    ++attempts;
+    qDebug() << "keeper reconnect  :" << attempts;
+    ftp->connectToHost(ftpUrl.host(), ftpUrl.port(21));
+    ftp->login(ftpUrl.userName(), ftpUrl.password());
+}
@@ -0,0 +1,58 @@
+#ifndef SESSIONKEEPER_H
+#define SESSIONKEEPER_H
+
+#include <qobject.h>
+#include <qftp.h>
+#include <qtimer.h>
+#include <qurl.h>
+
+#include "ftpengine.h"
+
+class SessionKeeper : public QObject
+{
+    Q_OBJECT
+
+public:
+    SessionKeeper(QObject *parent = 0);
+
+    void setConnection(FtpEngine *ftp);
+    void setUrl(const QUrl &url);
+
+    int keepAliveInterval() const;
+    void setKeepAliveInterval(int msecs);
+
+    bool reconnectEnabled() const;
+    void setReconnectEnabled(bool enabled);
+    int maxAttempts() const;
+    void setMaxAttempts(int attempts);
+
+    bool isReconnecting() const;
+
+public slots:
+    void close();
+
+signals:
+    void reconnecting();
+    void reconnected();
+    void lost();
+
+private slots:
+    void stateChanged(int state);
+    void activity();
+    void keepAlive();
+    void reconnect();
+
+private:
+    FtpEngine *ftp;
+    QUrl ftpUrl;
+    QTimer idleTimer;
+    QTimer retryTimer;
+    bool retry;
+    bool closing;
+    bool loggedIn;
+    bool active;
+    int attempts;
+    int attemptLimit;
+};
+
+#endif // SESSIONKEEPER_H
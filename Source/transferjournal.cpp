@@ -0,0 +1,176 @@
+#include "transferjournal.h"
+
+#include <qdatastream.h>
+#include <qdir.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <qdebug.h>
+
+static const quint32 JournalMagic = 0x46544a31; // "FTJ1"
+
+/*!
+    \class TransferJournal transferjournal.h
+
+    \brief The TransferJournal class records how far interrupted
+    transfers got, so they can be resumed instead of restarted.
+
+    Every entry remembers the server, both paths and, per byte range,
+    how many bytes are known to be committed. Plain transfers have a
+    single range starting at 0, segmented downloads one per segment.
+    Only downloads are checkpointed while they run. The range of an
+    upload stays at 0, it is resumed from the size the server reports
+    for the remote file.
+    Changes are written to disk at most once a second and the file is
+    replaced atomically, so a crash leaves the previous journal intact.
+
+    \sa TransferPool
+*/
+
+TransferJournal::TransferJournal(const QString &fileName, QObject *parent)
+    : QObject(parent), path(fileName)
+{
+    syncTimer.setSingleShot(true);
+    syncTimer.setInterval(1000);
+    connect(&syncTimer, SIGNAL(timeout()), this, SLOT(sync()));
+    load();
+}
+
+TransferJournal::~TransferJournal()
+{
+    if (syncTimer.isActive())
+        sync();
+}
+
+/*!
+    Returns the key identifying a transfer of \a remotePath on the server
+    of \a url to or from \a localPath.
+ */
+QString TransferJournal::key(int direction, const QUrl &url,
+                             const QString &remotePath, const QString &localPath)
+{
+    return QString("%1|%2@%3:%4|%5|%6").arg(direction).arg(url.userName())
+            .arg(url.host()).arg(url.port(21)).arg(remotePath).arg(localPath);
+}
+
+bool TransferJournal::contains(const QString &key) const
+{
+    return journal.contains(key);
+}
+
+TransferJournal::Entry TransferJournal::entry(const QString &key) const
+{
+    return journal.value(key);
+}
+
+/*!
+    Returns all entries recorded for the server and user of \a url.
+ */
+QList<TransferJournal::Entry> TransferJournal::entries(const QUrl &url) const
+{
+    QList<Entry> found;
+    foreach (const Entry &e, journal) {
+        if (e.host == url.host() && e.port == url.port(21) && e.userName == url.userName())
+            found.append(e);
+    }
+    return found;
+}
+
+void TransferJournal::setEntry(const QString &key, const Entry &entry)
+{
+    journal.insert(key, entry);
+    scheduleSync();
+}
+
+/*!
+    Records that \a committed bytes of the range beginning at \a start
+    of the transfer \a key are safely stored.
+ */
+void TransferJournal::commit(const QString &key, qint64 start, qint64 committed)
+{
+    QHash<QString, Entry>::iterator it = journal.find(key);
+    if (it == journal.end())
+        return;
+    for (int i = 0; i < it->ranges.count(); ++i) {
+        if (it->ranges.at(i).start == start) {
+            it->ranges[i].committed = committed;
+            scheduleSync();
+            return;
+        }
+    }
+}
+
+void TransferJournal::remove(const QString &key)
+{
+    if (journal.remove(key))
+        scheduleSync();
+}
+
+/*!
+    Writes the journal to disk now.
+ */
+void TransferJournal::sync()
+{
+    syncTimer.stop();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QFile file(path + ".new");
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "TransferJournal" << file.errorString();
+        return;
+    }
+    QDataStream out(&file);
+    out << JournalMagic << quint32(journal.count());
+    foreach (const Entry &e, journal) {
+        out << qint32(e.direction) << e.host << qint32(e.port) << e.userName
+            << e.remotePath << e.localPath << e.total << e.localSize << e.localModified;
+        out << quint32(e.ranges.count());
+        foreach (const Range &r, e.ranges)
+            out << r.start << r.length << r.committed;
+    }
+    file.close();
+
+    QFile::remove(path);
+    if (!QFile::rename(file.fileName(), path))
+        qWarning() << "TransferJournal" << "cannot replace" << path;
+}
+
+void TransferJournal::load()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QDataStream in(&file);
+    quint32 magic, count;
+    in >> magic >> count;
+    if (magic != JournalMagic)
+        return;
+
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        Entry e;
+        qint32 direction, port;
+        quint32 ranges;
+        in >> direction >> e.host >> port >> e.userName >> e.remotePath >> e.localPath
+           >> e.total >> e.localSize >> e.localModified >> ranges;
+        e.direction = direction;
+        e.port = port;
+        for (quint32 j = 0; j < ranges && in.status() == QDataStream::Ok; ++j) {
+            Range r;
+            in >> r.start >> r.length >> r.committed;
+            e.ranges.append(r);
+        }
+        if (in.status() != QDataStream::Ok)
+            break;
+        QUrl url;
+        url.setHost(e.host);
+        url.setPort(e.port);
+        url.setUserName(e.userName);
+        journal.insert(key(e.direction, url, e.remotePath, e.localPath), e);
+    }
+    qDebug() << "journal loaded    :" << journal.count();
+}
+
+void TransferJournal::scheduleSync()
+{
+    if (!syncTimer.isActive())
+        syncTimer.start();
+}
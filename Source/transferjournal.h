@@ -0,0 +1,62 @@
+#ifndef TRANSFERJOURNAL_H
+#define TRANSFERJOURNAL_H
+
+#include <qobject.h>
+#include <qhash.h>
+#include <qlist.h>
+#include <qtimer.h>
+#include <qurl.h>
+
+class TransferJournal : public QObject
+{
+    Q_OBJECT
+
+public:
+    struct Range {
+        Range() : start(0), length(-1), committed(0) {}
+        qint64 start;
+        qint64 length;
+        qint64 committed;
+    };
+
+    struct Entry {
+        Entry() : direction(0), port(21), total(-1), localSize(-1), localModified(0) {}
+        int direction;
+        QString host;
+        int port;
+        QString userName;
+        QString remotePath;
+        QString localPath;
+        qint64 total;
+        qint64 localSize;
+        uint localModified;
+        QList<Range> ranges;
+    };
+
+    TransferJournal(const QString &fileName, QObject *parent = 0);
+    ~TransferJournal();
+
+    static QString key(int direction, const QUrl &url,
+                       const QString &remotePath, const QString &localPath);
+
+    bool contains(const QString &key) const;
+    Entry entry(const QString &key) const;
+    QList<Entry> entries(const QUrl &url) const;
+
+    void setEntry(const QString &key, const Entry &entry);
+    void commit(const QString &key, qint64 start, qint64 committed);
+    void remove(const QString &key);
+
+public slots:
+    void sync();
+
+private:
+    QString path;
+    QHash<QString, Entry> journal;
+    QTimer syncTimer;
+
+    void load();
+    void scheduleSync();
+};
+
+#endif // TRANSFERJOURNAL_H
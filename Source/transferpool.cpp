@@ -0,0 +1,1086 @@
+#include "transferpool.h"
+#include "downloadsink.h"
+
+#include <qdesktopservices.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <qdatetime.h>
+#include <qset.h>
+#include <qdebug.h>
+
+// Bytes transferred between two journal checkpoints of one transfer.
+static const qint64 CheckpointInterval = 4 * 1024 * 1024;
+
+/*!
+    \class TransferPool transferpool.h
+
+    \brief The TransferPool class spreads queued file transfers over a
+    number of independent, logged in ftp sessions.
+
+    The pool is kept apart from the connection used by FtpModel, so
+    browsing the remote tree stays responsive while a large batch is
+    moving. Sessions are opened lazily with the credentials given to
+    setUrl(), never more than sessionCount() and never more than there
+    are queued transfers. Each session negotiates the data connection
+    for its next transfer while the current one streams, so batches of
+    small files run without gaps.
+
+    Downloads of at least segmentThreshold() bytes are split into
+    segmentCount() byte ranges which are fetched over several sessions
+    at once with REST, each written at its offset in a preallocated
+    local file. A failed range is retried from where it stopped up to
+    retryCount() times.
+
+    Transfers are not modeled here but in a TransferQueue, which decides
+    what runs next, can pause or cancel transfers and keeps them across
+    restarts. Sessions stay logged in between batches, kept alive with
+    NOOPs by a SessionKeeper. A session the server drops is simply
+    replaced by a new one when there is work for it. A server refusing
+    more connections is left with the sessions it accepted, and
+    sessions which cannot connect are opened again later and later.
+    Only refused credentials end the transfers at once.
+
+    Progress is checkpointed in a TransferJournal. A failed transfer is
+    retried from its last checkpoint, and transfers interrupted by a
+    disconnect or by quitting the application can be picked up again
+    with resumePending(). Downloads continue with REST at the committed
+    offset, uploads with REST and STOR at the size the server reports.
+
+    With verification() on, every finished transfer is compared with the
+    checksum the server computes by a ChecksumVerifier. Uploads are
+    hashed locally while they are sent. A mismatch marks the transfer
+    as failed and is reported by transferVerified().
+
+    With skipIdentical() on, an upload whose remote file has the same
+    size is compared by checksum first and not sent if the contents are
+    the same. The local checksums are kept across sessions, so unchanged
+    files are not read again.
+
+    With a compressionLevel() set, transfers run in MODE Z on servers
+    which support it, except for files which are compressed already.
+
+    \sa FtpModel
+*/
+
+TransferPool::TransferPool(QObject *parent)
+    : QObject(parent), maxSessions(4), sessionLimit(0), connectFailures(0), segments(1), threshold(64 * 1024 * 1024),
+    maxRetries(3), keepAlive(60 * 1000), directThreshold(0), verifyChecksums(false), skipSame(false),
+    compression(0), lastRangeId(0),
+    aborting(false), finishedBytes(0)
+{
+    QString dataPath = QDesktopServices::storageLocation(QDesktopServices::DataLocation);
+    journal = new TransferJournal(dataPath + "/transfers.journal", this);
+    transfers = new TransferQueue(dataPath + "/queue.dat", this);
+    connect(transfers, SIGNAL(queued()), this, SLOT(dispatch()));
+    connect(transfers, SIGNAL(stopRequested(int)), this, SLOT(stop(int)));
+    hasher = new FileHasher(dataPath + "/hashes.cache", this);
+    verifier = new ChecksumVerifier(hasher, this);
+    connect(verifier, SIGNAL(verified(int, int)), this, SLOT(checksumVerified(int, int)));
+    retryTimer.setSingleShot(true);
+    connect(&retryTimer, SIGNAL(timeout()), this, SLOT(dispatch()));
+}
+
+TransferPool::~TransferPool()
+{
+    abortAll();
+    journal->sync();
+    transfers->sync();
+}
+
+/*!
+    Sets the server and the credentials used by new sessions to \a url.
+    Sessions logged in with other credentials are closed.
+ */
+void TransferPool::setUrl(const QUrl &url)
+{
+    if (url == ftpUrl)
+        return;
+    ftpUrl = url;
+    sessionLimit = 0;
+    connectFailures = 0;
+    retryTimer.stop();
+    verifier->setUrl(url);
+    foreach (Session *s, sessions) {
+        if (!s->jobId)
+            dropSession(s);
+    }
+    dispatch();
+}
+
+QUrl TransferPool::url() const
+{
+    return ftpUrl;
+}
+
+/*!
+    Returns the maximum number of sessions opened in parallel.
+ */
+int TransferPool::sessionCount() const
+{
+    return maxSessions;
+}
+
+/*!
+    Sets the maximum number of sessions opened in parallel to \a count.
+ */
+void TransferPool::setSessionCount(int count)
+{
+    maxSessions = qMax(1, count);
+    dispatch();
+}
+
+/*!
+    Returns the number of ranges a large download is split into.
+    1 disables segmented downloads.
+ */
+int TransferPool::segmentCount() const
+{
+    return segments;
+}
+
+void TransferPool::setSegmentCount(int count)
+{
+    segments = qMax(1, count);
+}
+
+/*!
+    Returns the size from which on downloads are segmented.
+ */
+qint64 TransferPool::segmentThreshold() const
+{
+    return threshold;
+}
+
+void TransferPool::setSegmentThreshold(qint64 bytes)
+{
+    threshold = bytes;
+}
+
+/*!
+    Returns how often a failed transfer, or a failed range of a segmented
+    download, is retried.
+ */
+int TransferPool::retryCount() const
+{
+    return maxRetries;
+}
+
+void TransferPool::setRetryCount(int count)
+{
+    maxRetries = qMax(0, count);
+}
+
+/*!
+    Returns the time in milliseconds an idle session may sit between two
+    batches before it is sent a NOOP.
+ */
+int TransferPool::keepAliveInterval() const
+{
+    return keepAlive;
+}
+
+void TransferPool::setKeepAliveInterval(int msecs)
+{
+    keepAlive = msecs;
+    foreach (Session *s, sessions)
+        s->keeper->setKeepAliveInterval(msecs);
+}
+
+/*!
+    Returns the size from which on downloads are written with O_DIRECT,
+    bypassing the page cache. 0 disables direct I/O.
+ */
+qint64 TransferPool::directIoThreshold() const
+{
+    return directThreshold;
+}
+
+void TransferPool::setDirectIoThreshold(qint64 bytes)
+{
+    directThreshold = qMax(qint64(0), bytes);
+}
+
+/*!
+    Returns true if finished transfers are compared with the server's
+    checksum of them. Off by default.
+ */
+bool TransferPool::verification() const
+{
+    return verifyChecksums;
+}
+
+void TransferPool::setVerification(bool enabled)
+{
+    verifyChecksums = enabled;
+}
+
+/*!
+    Returns true if uploads are skipped when the server has the same
+    file already. Off by default.
+ */
+bool TransferPool::skipIdentical() const
+{
+    return skipSame;
+}
+
+void TransferPool::setSkipIdentical(bool skip)
+{
+    skipSame = skip;
+}
+
+/*!
+    Returns the zlib level of transfers in MODE Z, or 0 if they are not
+    compressed. 0 by default.
+ */
+int TransferPool::compressionLevel() const
+{
+    return compression;
+}
+
+void TransferPool::setCompressionLevel(int level)
+{
+    compression = qBound(0, level, 9);
+    foreach (Session *s, sessions)
+        s->ftp->setCompressionLevel(compression);
+}
+
+/*!
+    Returns the queue this pool drains.
+ */
+TransferQueue *TransferPool::transferQueue() const
+{
+    return transfers;
+}
+
+/*!
+    Queues the local file \a localPath to be stored as \a remotePath with
+    \a priority and returns the id of the transfer.
+ */
+int TransferPool::upload(const QString &localPath, const QString &remotePath,
+                         TransferQueue::Priority priority)
+{
+    Job job;
+    job.direction = Upload;
+    job.localPath = localPath;
+    job.remotePath = remotePath;
+    job.total = QFileInfo(localPath).size();
+    return enqueue(job, priority);
+}
+
+/*!
+    Queues the remote file \a remotePath of \a size bytes, if known, to
+    be saved as \a localPath with \a priority and returns the id of the
+    transfer.
+ */
+int TransferPool::download(const QString &remotePath, const QString &localPath, qint64 size,
+                           TransferQueue::Priority priority)
+{
+    Job job;
+    job.direction = Download;
+    job.localPath = localPath;
+    job.remotePath = remotePath;
+    job.total = size;
+    return enqueue(job, priority);
+}
+
+/*!
+    Returns the direction of the transfer \a id.
+ */
+TransferPool::Direction TransferPool::direction(int id) const
+{
+    if (jobs.contains(id))
+        return jobs.value(id).direction;
+    return Direction(transfers->item(id).direction);
+}
+
+/*!
+    Returns the number of transfers that are queued or running.
+ */
+int TransferPool::pendingCount() const
+{
+    return transfers->count(TransferQueue::Queued) + transfers->count(TransferQueue::Running);
+}
+
+bool TransferPool::isIdle() const
+{
+    return jobs.isEmpty();
+}
+
+/*!
+    Returns the number of interrupted transfers on the current server
+    which are not in the queue anymore.
+ */
+int TransferPool::resumableCount() const
+{
+    QSet<QString> pending;
+    foreach (const TransferQueue::Item &item, transfers->items()) {
+        if (item.state != TransferQueue::Finished && item.state != TransferQueue::Cancelled)
+            pending.insert(TransferJournal::key(item.direction, ftpUrl, item.remotePath, item.localPath));
+    }
+
+    int count = 0;
+    foreach (const TransferJournal::Entry &e, journal->entries(ftpUrl)) {
+        if (!pending.contains(TransferJournal::key(e.direction, ftpUrl, e.remotePath, e.localPath)))
+            ++count;
+    }
+    return count;
+}
+
+/*!
+    Queues every interrupted transfer on the current server again. They
+    continue from their last checkpoint.
+ */
+void TransferPool::resumePending()
+{
+    QSet<QString> pending;
+    foreach (const TransferQueue::Item &item, transfers->items()) {
+        if (item.state != TransferQueue::Finished && item.state != TransferQueue::Cancelled)
+            pending.insert(TransferJournal::key(item.direction, ftpUrl, item.remotePath, item.localPath));
+    }
+
+    foreach (const TransferJournal::Entry &e, journal->entries(ftpUrl)) {
+        if (pending.contains(TransferJournal::key(e.direction, ftpUrl, e.remotePath, e.localPath)))
+            continue;
+        if (e.direction == Upload)
+            upload(e.localPath, e.remotePath);
+        else
+            download(e.remotePath, e.localPath, e.total);
+    }
+}
+
+/*!
+    Forgets the interrupted transfers on the current server.
+ */
+void TransferPool::discardPending()
+{
+    foreach (const TransferJournal::Entry &e, journal->entries(ftpUrl))
+        journal->remove(TransferJournal::key(e.direction, ftpUrl, e.remotePath, e.localPath));
+}
+
+/*!
+    Closes all sessions and forgets the server until setUrl() is called
+    again. Running transfers are put back into the queue and continue
+    from their last checkpoint then.
+ */
+void TransferPool::abortAll()
+{
+    aborting = true;
+    queue.clear();
+    while (!sessions.isEmpty())
+        dropSession(sessions.first());
+    foreach (const Job &job, jobs) {
+        if (!job.parent) {
+            emit transferFinished(job.id, true);
+            transfers->setState(job.id, TransferQueue::Queued);
+        }
+    }
+    jobs.clear();
+    finishedBytes = 0;
+    ftpUrl = QUrl();
+    comparing.clear();
+    verifier->abort();
+    aborting = false;
+}
+
+int TransferPool::enqueue(const Job &job, TransferQueue::Priority priority)
+{
+    TransferQueue::Item item;
+    item.direction = job.direction;
+    item.host = ftpUrl.host();
+    item.port = ftpUrl.port(21);
+    item.userName = ftpUrl.userName();
+    item.remotePath = job.remotePath;
+    item.localPath = job.localPath;
+    item.size = job.total;
+    item.priority = priority;
+    // TransferQueue::queued() dispatches it.
+    return transfers->add(item);
+}
+
+/*!
+    Returns the id of the next job to run: retries and ranges of running
+    transfers first, then whatever the queue picks. Returns 0 if there is
+    nothing to do.
+ */
+int TransferPool::takeNext()
+{
+    if (!queue.isEmpty())
+        return queue.takeFirst();
+
+    int id = transfers->next(ftpUrl);
+    if (!id)
+        return 0;
+
+    TransferQueue::Item item = transfers->item(id);
+    Job job;
+    job.id = id;
+    job.direction = Direction(item.direction);
+    job.localPath = item.localPath;
+    job.remotePath = item.remotePath;
+    job.total = item.size;
+    jobs.insert(id, job);
+    transfers->setState(id, TransferQueue::Running);
+    return id;
+}
+
+/*!
+    Hands queued transfers to idle sessions, opening new ones while the
+    pool is below sessionCount() and the number of sessions the server
+    accepts.
+ */
+void TransferPool::dispatch()
+{
+    if (ftpUrl.isEmpty() || aborting)
+        return;
+
+    foreach (Session *s, sessions) {
+        if (s->jobId)
+            continue;
+        int id = takeNext();
+        if (!id)
+            return;
+        start(s, id);
+    }
+
+    int limit = sessionLimit ? qMin(maxSessions, sessionLimit) : maxSessions;
+    while (sessions.count() < limit && !retryTimer.isActive()) {
+        int id = takeNext();
+        if (!id)
+            return;
+        start(openSession(), id);
+    }
+}
+
+/*!
+    Stops the transfer \a id which has been paused or cancelled in the
+    queue. Its journal entry is kept, so it continues where it stopped.
+ */
+void TransferPool::stop(int id)
+{
+    if (!jobs.contains(id))
+        return;
+    jobs[id].stopped = true;
+
+    foreach (int queued, queue) {
+        if (queued == id || jobs.value(queued).parent == id) {
+            queue.removeAll(queued);
+            if (queued != id) {
+                jobs.remove(queued);
+                --jobs[id].ranges;
+            }
+        }
+    }
+
+    bool running = false;
+    foreach (Session *s, sessions) {
+        if (s->jobId && (s->jobId == id || jobs.value(s->jobId).parent == id)) {
+            running = true;
+            if (s->command)
+                s->ftp->abort();
+            else
+                finish(s, true);
+        }
+    }
+    if (!running && jobs.contains(id))
+        finishJob(id, true);
+    dispatch();
+}
+
+bool TransferPool::isStopped(const Job &job) const
+{
+    return job.stopped || (job.parent && jobs.value(job.parent).stopped);
+}
+
+void TransferPool::start(Session *session, int jobId)
+{
+    Job &job = jobs[jobId];
+    session->jobId = jobId;
+
+    if (!job.started) {
+        job.started = true;
+        emit transferStarted(jobId);
+        // Hashed while it is sent.
+        if (verifyChecksums && job.direction == Upload && !job.parent)
+            verifier->prepare(job.localPath);
+    }
+    if (!job.parent && !job.sized) {
+        job.sized = true;
+        if (probe(session, job)) {
+            if (!session->jobId && !queue.isEmpty())
+                start(session, queue.takeFirst());
+            return;
+        }
+    }
+
+    if (job.direction == Upload) {
+        session->device = new QFile(job.localPath);
+    } else {
+        qint64 size = job.parent ? jobs.value(job.parent).total : job.total;
+        session->sink = new DownloadSink(job.localPath, job.offset, job.length);
+        if (!job.parent)
+            session->sink->setExpectedSize(size);
+        session->sink->setDirectIo(directThreshold > 0 && size >= directThreshold);
+        session->device = session->sink;
+    }
+
+    QIODevice::OpenMode mode = (job.direction == Upload) ? QIODevice::ReadOnly : QIODevice::WriteOnly;
+    if (!session->device->open(mode)
+        || (job.direction == Upload && !session->device->seek(job.offset))) {
+        qWarning() << "TransferPool" << session->device->errorString();
+        finish(session, true);
+        dispatch();
+        return;
+    }
+
+    if (!job.parent && !journal->contains(journalKey(job))) {
+        TransferJournal::Entry entry;
+        entry.direction = job.direction;
+        entry.host = ftpUrl.host();
+        entry.port = ftpUrl.port(21);
+        entry.userName = ftpUrl.userName();
+        entry.remotePath = job.remotePath;
+        entry.localPath = job.localPath;
+        entry.total = job.total;
+        if (job.direction == Upload) {
+            QFileInfo info(job.localPath);
+            entry.localSize = info.size();
+            entry.localModified = info.lastModified().toTime_t();
+        }
+        entry.ranges.append(TransferJournal::Range());
+        journal->setEntry(journalKey(job), entry);
+    }
+    job.journaled = job.offset - job.start;
+
+    if (job.direction == Upload)
+        session->command = session->ftp->put(session->device, job.remotePath, job.offset);
+    else
+        session->command = session->ftp->get(job.remotePath, session->device, job.offset, job.length);
+    qDebug() << "pool transfer     :" << jobId << job.remotePath << job.offset;
+}
+
+/*!
+    Decides where the new transfer \a job on \a session begins. Returns
+    true if the session is busy finding out, or the job has been split.
+ */
+bool TransferPool::probe(Session *session, Job &job)
+{
+    QString key = journalKey(job);
+
+    if (job.direction == Upload) {
+        // Only resume uploads the journal knows about; the remote file
+        // may be unrelated otherwise.
+        if (journal->contains(key)) {
+            TransferJournal::Entry entry = journal->entry(key);
+            QFileInfo info(job.localPath);
+            if (entry.localSize != info.size()
+                || entry.localModified != info.lastModified().toTime_t()) {
+                journal->remove(key);
+                return false;
+            }
+            session->sizeCommand = session->ftp->size(job.remotePath);
+            return true;
+        }
+        if (skipSame) {
+            // A remote file of the same size may be the same file.
+            session->sizeCommand = session->ftp->size(job.remotePath);
+            return true;
+        }
+        return false;
+    }
+
+    if (journal->contains(key)) {
+        TransferJournal::Entry entry = journal->entry(key);
+        qint64 committed = 0;
+        foreach (const TransferJournal::Range &r, entry.ranges)
+            committed += r.committed;
+        if (QFileInfo(job.localPath).size() < committed) {
+            journal->remove(key);
+        } else if (entry.ranges.count() > 1) {
+            qDebug() << "pool resume ranges:" << job.id << committed;
+            job.total = entry.total;
+            job.done = committed;
+            session->jobId = 0;
+            addRanges(job.id, entry.ranges);
+            return true;
+        } else {
+            qDebug() << "pool resume       :" << job.id << committed;
+            job.offset = committed;
+            job.total = entry.total;
+            return false;
+        }
+    }
+
+    if (segments > 1) {
+        // The size decides whether the download is split at all.
+        session->sizeCommand = session->ftp->size(job.remotePath);
+        return true;
+    }
+    return false;
+}
+
+/*!
+    Splits the download on \a session into ranges once its size is known
+    and preallocates the local file. Small files are fetched in one go.
+ */
+void TransferPool::split(Session *session)
+{
+    int id = session->jobId;
+    Job &job = jobs[id];
+    session->jobId = 0;
+
+    if (job.total < threshold) {
+        start(session, id);
+        return;
+    }
+
+    if (!DownloadSink::preallocate(job.localPath, job.total)) {
+        finishJob(id, true);
+        return;
+    }
+
+    TransferJournal::Entry entry;
+    entry.direction = Download;
+    entry.host = ftpUrl.host();
+    entry.port = ftpUrl.port(21);
+    entry.userName = ftpUrl.userName();
+    entry.remotePath = job.remotePath;
+    entry.localPath = job.localPath;
+    entry.total = job.total;
+
+    qint64 chunk = job.total / segments;
+    for (int i = 0; i < segments; ++i) {
+        TransferJournal::Range range;
+        range.start = i * chunk;
+        range.length = (i == segments - 1) ? job.total - range.start : chunk;
+        entry.ranges.append(range);
+    }
+    journal->setEntry(journalKey(job), entry);
+    qDebug() << "pool segmented    :" << id << job.total << segments;
+    addRanges(id, entry.ranges);
+}
+
+/*!
+    Queues the unfinished \a ranges of the download \a id.
+ */
+void TransferPool::addRanges(int id, const QList<TransferJournal::Range> &ranges)
+{
+    Job &job = jobs[id];
+    QList<int> queued;
+    foreach (const TransferJournal::Range &r, ranges) {
+        if (r.committed >= r.length)
+            continue;
+        Job range;
+        range.id = --lastRangeId;
+        range.direction = Download;
+        range.localPath = job.localPath;
+        range.remotePath = job.remotePath;
+        range.parent = id;
+        range.start = r.start;
+        range.offset = r.start + r.committed;
+        range.length = r.length - r.committed;
+        range.total = r.length;
+        range.done = r.committed;
+        range.started = true;
+        jobs.insert(range.id, range);
+        queued.append(range.id);
+    }
+    job.ranges = queued.count();
+
+    if (queued.isEmpty()) {
+        finishJob(id, false);
+        return;
+    }
+    // Ranges go ahead of the queue so the download finishes as a whole.
+    for (int i = queued.count() - 1; i >= 0; --i)
+        queue.prepend(queued.at(i));
+}
+
+QString TransferPool::journalKey(const Job &job) const
+{
+    return TransferJournal::key(job.direction, ftpUrl, job.remotePath, job.localPath);
+}
+
+/*!
+    Records the bytes of the download on \a session that are on disk.
+ */
+void TransferPool::checkpoint(Session *session)
+{
+    Job &job = jobs[session->jobId];
+    if (job.direction != Download || !session->sink)
+        return;
+    // Only what the writer thread has put on disk counts.
+    qint64 committed = job.offset - job.start + session->sink->bytesCommitted();
+    if (committed - job.journaled < CheckpointInterval)
+        return;
+    job.journaled = committed;
+    const Job &owner = job.parent ? jobs[job.parent] : job;
+    journal->commit(journalKey(owner), job.start, committed);
+}
+
+/*!
+    Reports the job running on \a session as finished and leaves the
+    session idle.
+ */
+void TransferPool::finish(Session *session, bool error)
+{
+    int id = session->jobId;
+    if (!id)
+        return;
+
+    bool complete = !error;
+    if (session->sink) {
+        Job &job = jobs[id];
+        bool flushed = session->sink->flush();
+        if (!flushed) {
+            qWarning() << "TransferPool" << session->sink->errorString();
+            complete = false;
+        }
+        qint64 committed = job.offset - job.start + session->sink->bytesCommitted();
+        if (job.parent)
+            jobs[job.parent].done += committed - job.done;
+        job.done = committed;
+        job.journaled = committed;
+        const Job &owner = job.parent ? jobs[job.parent] : job;
+        journal->commit(journalKey(owner), job.start, committed);
+        if (job.parent)
+            complete = flushed && session->sink->isComplete();
+    }
+    if (session->device) {
+        session->device->close();
+        delete session->device;
+        session->device = 0;
+        session->sink = 0;
+    }
+    session->jobId = 0;
+    session->command = 0;
+    session->sizeCommand = 0;
+    session->remoteSize = -1;
+
+    Job &job = jobs[id];
+    if (job.parent) {
+        finishRange(id, complete);
+    } else if (!complete && !aborting && !job.stopped && job.retries < maxRetries) {
+        // Sized again: probe() continues a download from its journal
+        // entry and an upload from the size of the remote file.
+        ++job.retries;
+        job.sized = false;
+        job.offset = 0;
+        qDebug() << "pool retry        :" << id << job.retries;
+        queue.prepend(id);
+    } else {
+        finishJob(id, !complete);
+    }
+}
+
+/*!
+    Books the range \a id of a segmented download. Incomplete ranges are
+    queued again from the first byte not yet written.
+ */
+void TransferPool::finishRange(int id, bool complete)
+{
+    Job &range = jobs[id];
+    int parentId = range.parent;
+    Job &parent = jobs[parentId];
+
+    if (!complete && !aborting && !parent.stopped && !parent.failed && range.retries < maxRetries) {
+        range.offset = range.start + range.done;
+        range.length = range.total - range.done;
+        ++range.retries;
+        qDebug() << "pool retry range  :" << parentId << range.offset << range.retries;
+        queue.prepend(id);
+        return;
+    }
+
+    if (!complete && !parent.failed) {
+        parent.failed = true;
+        foreach (int queued, queue) {
+            if (jobs.value(queued).parent == parentId) {
+                queue.removeAll(queued);
+                jobs.remove(queued);
+                --parent.ranges;
+            }
+        }
+    }
+    jobs.remove(id);
+    if (--parent.ranges <= 0)
+        finishJob(parentId, parent.failed);
+}
+
+void TransferPool::finishJob(int id, bool error)
+{
+    Job job = jobs.value(id);
+    if (!error)
+        journal->remove(journalKey(job));
+    finishedBytes += qMax(job.total, job.done);
+    if (aborting)
+        transfers->setState(id, TransferQueue::Queued);
+    else if (!job.stopped)
+        transfers->setState(id, error ? TransferQueue::Failed : TransferQueue::Finished);
+    jobs.remove(id);
+    if (!job.stopped)
+        emit transferFinished(id, error);
+    if (verifyChecksums && !error && !aborting && !job.stopped && !job.skipped)
+        verifier->verify(id, job.localPath, job.remotePath);
+
+    if (jobs.isEmpty()) {
+        finishedBytes = 0;
+        emit done();
+    }
+}
+
+void TransferPool::checksumVerified(int id, int result)
+{
+    if (comparing.remove(id)) {
+        if (!jobs.contains(id))
+            return;
+        Job &job = jobs[id];
+        if (result == ChecksumVerifier::Match) {
+            qDebug() << "pool identical    :" << id << job.remotePath;
+            job.skipped = true;
+            job.done = job.total;
+            finishJob(id, false);
+        } else {
+            job.offset = 0;
+            queue.prepend(id);
+            dispatch();
+        }
+        return;
+    }
+    if (result == ChecksumVerifier::Unverified) {
+        qDebug() << "pool unverified   :" << id;
+        return;
+    }
+    bool match = result == ChecksumVerifier::Match;
+    if (!match) {
+        qWarning() << "TransferPool" << "checksum mismatch" << transfers->item(id).remotePath;
+        transfers->setState(id, TransferQueue::Failed);
+    }
+    emit transferVerified(id, match);
+}
+
+void TransferPool::dropSession(Session *session)
+{
+    sessions.removeAll(session);
+    session->ftp->disconnect(this);
+    // Returns once the engine has let go of the device.
+    session->ftp->abort();
+    finish(session, true);
+    session->ftp->close();
+    session->ftp->deleteLater();
+    delete session;
+}
+
+TransferPool::Session *TransferPool::openSession()
+{
+    Session *s = new Session;
+    s->ftp = new FtpEngine(this);
+    s->ftp->setPrenegotiation(true);
+    s->ftp->setCompressionLevel(compression);
+    connect(s->ftp, SIGNAL(stateChanged(int)), this, SLOT(sessionStateChanged(int)));
+    connect(s->ftp, SIGNAL(commandFinished(int,bool)),
+            this, SLOT(sessionCommandFinished(int,bool)));
+    connect(s->ftp, SIGNAL(rawCommandReply(int,QString)),
+            this, SLOT(sessionRawCommandReply(int,QString)));
+    connect(s->ftp, SIGNAL(dataTransferProgress(qint64,qint64)),
+            this, SLOT(sessionProgress(qint64,qint64)));
+    s->keeper = new SessionKeeper(s->ftp);
+    s->keeper->setConnection(s->ftp);
+    s->keeper->setReconnectEnabled(false);
+    s->keeper->setKeepAliveInterval(keepAlive);
+    s->connectCommand = s->ftp->connectToHost(ftpUrl.host(), ftpUrl.port(21));
+    s->loginCommand = s->ftp->login(ftpUrl.userName(), ftpUrl.password());
+    sessions.append(s);
+    return s;
+}
+
+TransferPool::Session *TransferPool::session(QObject *ftp) const
+{
+    foreach (Session *s, sessions) {
+        if (s->ftp == ftp)
+            return s;
+    }
+    return 0;
+}
+
+void TransferPool::sessionStateChanged(int state)
+{
+    Session *s = session(sender());
+    if (!s)
+        return;
+    if (state == QFtp::LoggedIn) {
+        s->loggedIn = true;
+        connectFailures = 0;
+        return;
+    }
+    if (state != QFtp::Unconnected)
+        return;
+    qDebug() << "pool session lost";
+    bool refused = !s->loggedIn;
+    int reply = s->ftp->replyCode();
+    dropSession(s);
+    if (refused)
+        sessionRefused(reply);
+    else
+        dispatch();
+}
+
+void TransferPool::sessionCommandFinished(int id, bool error)
+{
+    Session *s = session(sender());
+    if (!s)
+        return;
+
+    if (id == s->sizeCommand) {
+        s->sizeCommand = 0;
+        Job &job = jobs[s->jobId];
+        // Downloads go on with the size from the listing, uploads from
+        // the start.
+        if (error)
+            qWarning() << "TransferPool" << "SIZE" << job.remotePath << s->ftp->errorString();
+        if (job.direction == Upload) {
+            int jobId = s->jobId;
+            qint64 remoteSize = s->remoteSize;
+            s->jobId = 0;
+            s->remoteSize = -1;
+            if (!journal->contains(journalKey(job)) && remoteSize == job.total) {
+                // Sent only if the checksums differ, the session moves on.
+                comparing.insert(jobId);
+                verifier->verify(jobId, job.localPath, job.remotePath);
+            } else {
+                // Continue behind what the server already has.
+                bool resuming = journal->contains(journalKey(job));
+                job.offset = (resuming && remoteSize > 0 && remoteSize <= job.total) ? remoteSize : 0;
+                start(s, jobId);
+            }
+        } else {
+            if (s->remoteSize >= 0)
+                job.total = s->remoteSize;
+            s->remoteSize = -1;
+            split(s);
+        }
+        dispatch();
+    } else if (id == s->command) {
+        // A refused REST fails the transfer itself.
+        if (error && !(s->sink && s->sink->isComplete()))
+            qWarning() << "TransferPool" << s->ftp->errorString();
+        finish(s, error);
+        dispatch();
+    } else if (error && (id == s->connectCommand || id == s->loginCommand)) {
+        // The engine has dropped the rest. Failed keep-alives and other
+        // commands the pool did not send are left to the session keeper.
+        qWarning() << "TransferPool" << s->ftp->errorString();
+        int reply = s->ftp->replyCode();
+        dropSession(s);
+        sessionRefused(reply);
+    }
+}
+
+/*!
+    Goes on after a session could not connect or log in, refused with
+    the server's \a reply or 0 if there was none. Refused credentials
+    fail the transfers once no session is left. Too many connections
+    lower the number of sessions to those the server took. Otherwise new
+    sessions are opened again only after a pause, which doubles with
+    every failure, and the transfers fail after retryCount() failures in
+    a row.
+ */
+void TransferPool::sessionRefused(int reply)
+{
+    int working = 0;
+    foreach (Session *s, sessions) {
+        if (s->loggedIn)
+            ++working;
+    }
+    if (working && (reply == 421 || reply == 530)) {
+        // 530 stands for too many logins of the user on some servers.
+        qDebug() << "pool session limit:" << working;
+        sessionLimit = working;
+        dispatch();
+        return;
+    }
+    if (reply == 530) {
+        // Trying again with the same credentials would fail again.
+        if (sessions.isEmpty())
+            failAll();
+        return;
+    }
+    if (++connectFailures > maxRetries && sessions.isEmpty()) {
+        failAll();
+        return;
+    }
+    retryTimer.start(1000 << qMin(connectFailures, 6));
+    dispatch();
+}
+
+/*!
+    Fails every transfer taken from the queue, after the server could
+    not be logged in to.
+ */
+void TransferPool::failAll()
+{
+    retryTimer.stop();
+    connectFailures = 0;
+    foreach (const Job &job, jobs) {
+        if (!job.parent) {
+            transfers->setState(job.id, TransferQueue::Failed);
+            emit transferFinished(job.id, true);
+        }
+    }
+    queue.clear();
+    jobs.clear();
+    finishedBytes = 0;
+    emit done();
+}
+
+void TransferPool::sessionRawCommandReply(int code, const QString &detail)
+{
+    Session *s = session(sender());
+    if (!s || !s->sizeCommand || code != 213)
+        return;
+    bool ok;
+    qint64 size = detail.trimmed().toLongLong(&ok);
+    if (ok)
+        s->remoteSize = size;
+}
+
+void TransferPool::sessionProgress(qint64 done, qint64 total)
+{
+    Session *s = session(sender());
+    if (!s || !s->jobId)
+        return;
+
+    Job &job = jobs[s->jobId];
+    if (s->sink) {
+        // The sink belongs to the engine's thread until the transfer is
+        // over; the engine stops a range at its end by itself.
+        qint64 committed = job.offset - job.start + done;
+        if (job.parent)
+            jobs[job.parent].done += committed - job.done;
+        job.done = committed;
+        checkpoint(s);
+    } else {
+        job.done = job.offset + done;
+    }
+    if (!job.parent && total > 0)
+        job.total = qMax(total, job.total);
+    const Job &owner = job.parent ? jobs[job.parent] : job;
+    transfers->setProgress(owner.id, owner.done, owner.total);
+    updateProgress();
+}
+
+/*!
+    Emits the progress of all transfers queued since the pool was
+    last idle.
+ */
+void TransferPool::updateProgress()
+{
+    qint64 done = finishedBytes;
+    qint64 total = finishedBytes;
+    foreach (const Job &job, jobs) {
+        if (job.parent)
+            continue;
+        done += job.done;
+        total += qMax(job.done, job.total);
+    }
+    emit dataTransferProgress(done, total);
+}
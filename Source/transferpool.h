@@ -0,0 +1,178 @@
+#ifndef TRANSFERPOOL_H
+#define TRANSFERPOOL_H
+
+#include <qobject.h>
+#include <qftp.h>
+#include <qurl.h>
+#include <qlist.h>
+#include <qhash.h>
+#include <qset.h>
+#include <qtimer.h>
+
+#include "ftpengine.h"
+#include "transferjournal.h"
+#include "transferqueue.h"
+#include "sessionkeeper.h"
+#include "checksumverifier.h"
+
+class QIODevice;
+class DownloadSink;
+
+class TransferPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum Direction { Upload, Download };
+
+    TransferPool(QObject *parent = 0);
+    ~TransferPool();
+
+    void setUrl(const QUrl &url);
+    QUrl url() const;
+
+    int sessionCount() const;
+    void setSessionCount(int count);
+
+    int segmentCount() const;
+    void setSegmentCount(int count);
+    qint64 segmentThreshold() const;
+    void setSegmentThreshold(qint64 bytes);
+    int retryCount() const;
+    void setRetryCount(int count);
+    int keepAliveInterval() const;
+    void setKeepAliveInterval(int msecs);
+    qint64 directIoThreshold() const;
+    void setDirectIoThreshold(qint64 bytes);
+    bool verification() const;
+    void setVerification(bool enabled);
+    bool skipIdentical() const;
+    void setSkipIdentical(bool skip);
+    int compressionLevel() const;
+    void setCompressionLevel(int level);
+
+    TransferQueue *transferQueue() const;
+
+    int upload(const QString &localPath, const QString &remotePath,
+               TransferQueue::Priority priority = TransferQueue::Normal);
+    int download(const QString &remotePath, const QString &localPath, qint64 size = -1,
+                 TransferQueue::Priority priority = TransferQueue::Normal);
+
+    Direction direction(int id) const;
+    int pendingCount() const;
+    bool isIdle() const;
+
+    int resumableCount() const;
+
+public slots:
+    void abortAll();
+    void resumePending();
+    void discardPending();
+    void dispatch();
+
+signals:
+    void transferStarted(int id);
+    void transferFinished(int id, bool error);
+    void transferVerified(int id, bool match);
+    void dataTransferProgress(qint64 done, qint64 total);
+    void done();
+
+private slots:
+    void sessionStateChanged(int state);
+    void sessionCommandFinished(int id, bool error);
+    void sessionRawCommandReply(int code, const QString &detail);
+    void sessionProgress(qint64 done, qint64 total);
+    void stop(int id);
+    void checksumVerified(int id, int result);
+
+private:
+    struct Job {
+        Job() : id(0), direction(Upload), done(0), total(-1), parent(0), start(0),
+            offset(0), length(-1), retries(0), ranges(0), sized(false), failed(false),
+            started(false), stopped(false), skipped(false), journaled(0) {}
+        int id;
+        Direction direction;
+        QString localPath;
+        QString remotePath;
+        qint64 done;
+        qint64 total;
+
+        // Segmented downloads: a range job belongs to its parent download.
+        int parent;
+        qint64 start;
+        qint64 offset;
+        qint64 length;
+        int retries;
+        int ranges;
+        bool sized;
+        bool failed;
+        bool started;
+        bool stopped;
+        bool skipped;       // identical on the server, not sent
+        qint64 journaled;
+    };
+
+    struct Session {
+        Session() : ftp(0), keeper(0), device(0), sink(0), connectCommand(0), loginCommand(0),
+            command(0), sizeCommand(0), jobId(0), remoteSize(-1), loggedIn(false) {}
+        FtpEngine *ftp;
+        SessionKeeper *keeper;
+        QIODevice *device;
+        DownloadSink *sink;
+        int connectCommand;
+        int loginCommand;
+        int command;
+        int sizeCommand;
+        int jobId;
+        qint64 remoteSize;
+        bool loggedIn;
+    };
+
+    QUrl ftpUrl;
+    int maxSessions;
+    int sessionLimit;       // sessions the server accepts, 0 if not known
+    int connectFailures;
+    QTimer retryTimer;      // runs while no new session is opened
+    int segments;
+    qint64 threshold;
+    int maxRetries;
+    int keepAlive;
+    qint64 directThreshold;
+    bool verifyChecksums;
+    bool skipSame;
+    int compression;
+    int lastRangeId;
+    bool aborting;
+    TransferJournal *journal;
+    TransferQueue *transfers;
+    FileHasher *hasher;
+    ChecksumVerifier *verifier;
+
+    QList<Session*> sessions;
+    QList<int> queue;
+    QHash<int, Job> jobs;
+    QSet<int> comparing;    // uploads waiting for the checksums to decide
+
+    qint64 finishedBytes;
+
+    int enqueue(const Job &job, TransferQueue::Priority priority);
+    int takeNext();
+    bool isStopped(const Job &job) const;
+    void start(Session *session, int jobId);
+    bool probe(Session *session, Job &job);
+    void split(Session *session);
+    void addRanges(int id, const QList<TransferJournal::Range> &ranges);
+    QString journalKey(const Job &job) const;
+    void checkpoint(Session *session);
+    void finish(Session *session, bool error);
+    void finishRange(int id, bool complete);
+    void finishJob(int id, bool error);
+    void dropSession(Session *session);
+    void sessionRefused(int reply);
+    void failAll();
+    Session *openSession();
+    Session *session(QObject *ftp) const;
+    void updateProgress();
+};
+
+#endif // TRANSFERPOOL_H
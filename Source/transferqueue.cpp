@@ -0,0 +1,487 @@
+#include "transferqueue.h"
+
+#include <qdatastream.h>
+#include <qdir.h>
+#include <qfile.h>
+#include <qfileinfo.h>
+#include <qlocale.h>
+#include <qdebug.h>
+
+#include <limits>
+
+static const quint32 QueueMagic = 0x46545131; // "FTQ1"
+
+// Finished transfers kept in the queue; beyond that the oldest half goes.
+static const int MaxFinished = 1000;
+
+/*!
+    \class TransferQueue transferqueue.h
+
+    \brief The TransferQueue class is the model of all transfers the user
+    has asked for, together with their state and priority.
+
+    \ingroup model-view
+
+    TransferPool drains the queue: next() picks the queued transfer to
+    run next for a server, highest priority first and then by policy().
+    Transfers can be paused, resumed and cancelled at any time; pausing
+    or cancelling a running transfer emits stopRequested().
+
+    Unfinished transfers are written to disk at most once a second and
+    show up again after a restart.
+
+    Transfers are found by id through a hash, and the queued ones are
+    kept per priority in policy order, so neither next() nor updates
+    scan the queue. Only the latest MaxFinished finished transfers stay.
+
+    \sa TransferPool
+*/
+
+TransferQueue::TransferQueue(const QString &fileName, QObject *parent)
+    : QAbstractTableModel(parent), path(fileName), order(FirstInFirstOut), lastId(0)
+{
+    for (int i = 0; i <= Cancelled; ++i)
+        states[i] = 0;
+    syncTimer.setSingleShot(true);
+    syncTimer.setInterval(1000);
+    connect(&syncTimer, SIGNAL(timeout()), this, SLOT(sync()));
+    load();
+}
+
+TransferQueue::~TransferQueue()
+{
+    if (syncTimer.isActive())
+        sync();
+}
+
+/*!
+    \reimp
+ */
+int TransferQueue::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return queue.count();
+}
+
+/*!
+    \reimp
+ */
+int TransferQueue::columnCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return 6;
+}
+
+/*!
+    \reimp
+ */
+QVariant TransferQueue::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= queue.count())
+        return QVariant();
+
+    const Item &item = queue.at(index.row());
+    switch (role) {
+    case Qt::DisplayRole:
+        switch (index.column()) {
+        case 0: return QFileInfo(item.localPath).fileName();
+        case 1: return item.direction ? tr("Download") : tr("Upload");
+        case 2: {
+            if (item.size < 0)
+                return QString();
+            qint64 bytes = item.size;
+            if (bytes >= 1000000000)
+                return QLocale().toString(bytes / 1000000000) + QString(" GB");
+            if (bytes >= 1000000)
+                return QLocale().toString(bytes / 1000000) + QString(" MB");
+            if (bytes >= 1000)
+                return QLocale().toString(bytes / 1000) + QString(" KB");
+            return QLocale().toString(bytes) + QString(" bytes");
+        }
+        case 3:
+            if (item.size <= 0)
+                return QString();
+            return QString("%1%").arg(int(item.done * 100 / item.size));
+        case 4:
+            switch (item.state) {
+            case Queued: return tr("Queued");
+            case Running: return tr("Running");
+            case Paused: return tr("Paused");
+            case Finished: return tr("Finished");
+            case Failed: return tr("Failed");
+            case Cancelled: return tr("Cancelled");
+            }
+            break;
+        case 5:
+            switch (item.priority) {
+            case Low: return tr("Low");
+            case Normal: return tr("Normal");
+            case High: return tr("High");
+            }
+            break;
+        }
+        break;
+    case Qt::ToolTipRole:
+        return QString("%1 %2 %3").arg(item.localPath)
+                .arg(item.direction ? "<-" : "->").arg(item.remotePath);
+    case Qt::TextAlignmentRole:
+        if (index.column() == 2 || index.column() == 3)
+            return Qt::AlignRight;
+        break;
+    }
+    return QVariant();
+}
+
+/*!
+    \reimp
+ */
+QVariant TransferQueue::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation == Qt::Horizontal && role == Qt::DisplayRole) {
+        switch (section) {
+        case 0: return tr("Name");
+        case 1: return tr("Direction");
+        case 2: return tr("Size");
+        case 3: return tr("Progress");
+        case 4: return tr("Status");
+        case 5: return tr("Priority");
+        default: return QVariant();
+        }
+    }
+    return QAbstractTableModel::headerData(section, orientation, role);
+}
+
+/*!
+    Returns the order in which queued transfers of equal priority run.
+ */
+TransferQueue::Policy TransferQueue::policy() const
+{
+    return order;
+}
+
+void TransferQueue::setPolicy(Policy policy)
+{
+    if (policy == order)
+        return;
+    order = policy;
+    for (int i = Low; i <= High; ++i)
+        pending[i].clear();
+    foreach (const Item &item, queue) {
+        if (item.state == Queued)
+            pending[item.priority].insert(pendingKey(item), item.id);
+    }
+}
+
+/*!
+    Appends \a item to the queue and returns its id.
+ */
+int TransferQueue::add(const Item &item)
+{
+    Item added = item;
+    added.id = ++lastId;
+    beginInsertRows(QModelIndex(), queue.count(), queue.count());
+    rows.insert(added.id, queue.count());
+    queue.append(added);
+    track(added);
+    endInsertRows();
+    syncTimer.start();
+    if (added.state == Queued)
+        emit queued();
+    return added.id;
+}
+
+bool TransferQueue::contains(int id) const
+{
+    return row(id) >= 0;
+}
+
+TransferQueue::Item TransferQueue::item(int id) const
+{
+    int r = row(id);
+    return (r < 0) ? Item() : queue.at(r);
+}
+
+/*!
+    Returns the id of the transfer shown at \a index.
+ */
+int TransferQueue::id(const QModelIndex &index) const
+{
+    if (!index.isValid() || index.row() >= queue.count())
+        return 0;
+    return queue.at(index.row()).id;
+}
+
+QList<TransferQueue::Item> TransferQueue::items() const
+{
+    return queue;
+}
+
+/*!
+    Returns the id of the queued transfer for the server and user of
+    \a url which should run next, or 0 if there is none.
+ */
+int TransferQueue::next(const QUrl &url) const
+{
+    // Transfers for other servers are rare, so this stops at the first.
+    for (int p = High; p >= Low; --p) {
+        QMap<PendingKey, int>::const_iterator i;
+        for (i = pending[p].constBegin(); i != pending[p].constEnd(); ++i) {
+            const Item &item = queue.at(rows.value(i.value()));
+            if (item.host == url.host() && item.port == url.port(21)
+                && item.userName == url.userName())
+                return item.id;
+        }
+    }
+    return 0;
+}
+
+/*!
+    Returns the number of transfers in \a state.
+ */
+int TransferQueue::count(State state) const
+{
+    return states[state];
+}
+
+void TransferQueue::setState(int id, State state)
+{
+    int r = row(id);
+    if (r < 0 || queue.at(r).state == state)
+        return;
+    untrack(queue.at(r));
+    queue[r].state = state;
+    track(queue.at(r));
+    changed(r);
+    if (state == Queued)
+        emit queued();
+    if (state == Finished && states[Finished] > MaxFinished)
+        pruneFinished();
+}
+
+void TransferQueue::setProgress(int id, qint64 done, qint64 size)
+{
+    int r = row(id);
+    if (r < 0)
+        return;
+    bool requeue = size >= 0 && size != queue.at(r).size && queue.at(r).state == Queued;
+    if (requeue)
+        untrack(queue.at(r));
+    queue[r].done = done;
+    if (size >= 0)
+        queue[r].size = size;
+    if (requeue)
+        track(queue.at(r));
+    emit dataChanged(index(r, 2), index(r, 3));
+}
+
+void TransferQueue::setPriority(int id, TransferQueue::Priority priority)
+{
+    int r = row(id);
+    if (r < 0)
+        return;
+    untrack(queue.at(r));
+    queue[r].priority = priority;
+    track(queue.at(r));
+    changed(r);
+}
+
+/*!
+    Holds the transfer \a id back. A running transfer is stopped, it
+    continues from its last checkpoint when resumed.
+ */
+void TransferQueue::pause(int id)
+{
+    int r = row(id);
+    if (r < 0)
+        return;
+    State state = queue.at(r).state;
+    if (state != Queued && state != Running)
+        return;
+    setState(id, Paused);
+    if (state == Running)
+        emit stopRequested(id);
+}
+
+/*!
+    Queues the paused, failed or cancelled transfer \a id again.
+ */
+void TransferQueue::resume(int id)
+{
+    int r = row(id);
+    if (r < 0)
+        return;
+    State state = queue.at(r).state;
+    if (state == Paused || state == Failed || state == Cancelled)
+        setState(id, Queued);
+}
+
+void TransferQueue::cancel(int id)
+{
+    int r = row(id);
+    if (r < 0)
+        return;
+    State state = queue.at(r).state;
+    if (state == Finished || state == Cancelled)
+        return;
+    setState(id, Cancelled);
+    if (state == Running)
+        emit stopRequested(id);
+}
+
+/*!
+    Removes finished and cancelled transfers from the queue.
+ */
+void TransferQueue::removeFinished()
+{
+    QList<int> doomed;
+    for (int r = 0; r < queue.count(); ++r) {
+        if (queue.at(r).state == Finished || queue.at(r).state == Cancelled)
+            doomed.append(r);
+    }
+    removeItems(doomed);
+}
+
+/*!
+    Drops the oldest finished transfers, half of MaxFinished at a time,
+    so the rows are renumbered rarely.
+ */
+void TransferQueue::pruneFinished()
+{
+    QList<int> doomed;
+    int excess = states[Finished] - MaxFinished / 2;
+    for (int r = 0; r < queue.count() && doomed.count() < excess; ++r) {
+        if (queue.at(r).state == Finished)
+            doomed.append(r);
+    }
+    removeItems(doomed);
+}
+
+/*!
+    Removes the rows \a doomed, in ascending order, and renumbers the
+    rows behind the first of them.
+ */
+void TransferQueue::removeItems(const QList<int> &doomed)
+{
+    if (doomed.isEmpty())
+        return;
+    for (int i = doomed.count() - 1; i >= 0; --i) {
+        int r = doomed.at(i);
+        beginRemoveRows(QModelIndex(), r, r);
+        untrack(queue.at(r));
+        rows.remove(queue.at(r).id);
+        queue.removeAt(r);
+        endRemoveRows();
+    }
+    for (int r = doomed.first(); r < queue.count(); ++r)
+        rows.insert(queue.at(r).id, r);
+    syncTimer.start();
+}
+
+/*!
+    Writes the unfinished transfers to disk now.
+ */
+void TransferQueue::sync()
+{
+    syncTimer.stop();
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QFile file(path + ".new");
+    if (!file.open(QIODevice::WriteOnly)) {
+        qWarning() << "TransferQueue" << file.errorString();
+        return;
+    }
+    QList<Item> unfinished;
+    foreach (const Item &item, queue) {
+        if (item.state != Finished && item.state != Cancelled)
+            unfinished.append(item);
+    }
+
+    QDataStream out(&file);
+    out << QueueMagic << quint32(unfinished.count());
+    foreach (const Item &item, unfinished) {
+        // Whatever was running is queued again after a restart.
+        State state = (item.state == Running) ? Queued : item.state;
+        out << qint32(item.direction) << item.host << qint32(item.port) << item.userName
+            << item.remotePath << item.localPath << item.size << item.done
+            << qint32(item.priority) << qint32(state);
+    }
+    file.close();
+
+    QFile::remove(path);
+    if (!QFile::rename(file.fileName(), path))
+        qWarning() << "TransferQueue" << "cannot replace" << path;
+}
+
+int TransferQueue::row(int id) const
+{
+    return rows.value(id, -1);
+}
+
+/*!
+    Returns where the queued \a item ranks among those of its priority:
+    by id first in first out, otherwise by size with unknown sizes last.
+ */
+TransferQueue::PendingKey TransferQueue::pendingKey(const Item &item) const
+{
+    qint64 key = 0;
+    if (order != FirstInFirstOut && item.size < 0)
+        key = std::numeric_limits<qint64>::max();
+    else if (order != FirstInFirstOut)
+        key = order == SmallestFirst ? item.size : -item.size;
+    return qMakePair(key, item.id);
+}
+
+/*!
+    Counts \a item in its state and lists it as pending if it is queued.
+ */
+void TransferQueue::track(const Item &item)
+{
+    ++states[item.state];
+    if (item.state == Queued)
+        pending[item.priority].insert(pendingKey(item), item.id);
+}
+
+void TransferQueue::untrack(const Item &item)
+{
+    --states[item.state];
+    if (item.state == Queued)
+        pending[item.priority].remove(pendingKey(item));
+}
+
+void TransferQueue::changed(int row)
+{
+    emit dataChanged(index(row, 0), index(row, columnCount() - 1));
+    syncTimer.start();
+}
+
+void TransferQueue::load()
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    QDataStream in(&file);
+    quint32 magic, count;
+    in >> magic >> count;
+    if (magic != QueueMagic)
+        return;
+
+    for (quint32 i = 0; i < count; ++i) {
+        Item item;
+        qint32 direction, port, priority, state;
+        in >> direction >> item.host >> port >> item.userName >> item.remotePath
+           >> item.localPath >> item.size >> item.done >> priority >> state;
+        if (in.status() != QDataStream::Ok)
+            break;
+        item.id = ++lastId;
+        item.direction = direction;
+        item.port = port;
+        item.priority = Priority(priority);
+        item.state = State(state);
+        rows.insert(item.id, queue.count());
+        queue.append(item);
+        track(item);
+    }
+    qDebug() << "queue loaded      :" << queue.count();
+}
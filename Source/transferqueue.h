@@ -0,0 +1,94 @@
+#ifndef TRANSFERQUEUE_H
+#define TRANSFERQUEUE_H
+
+#include <qabstractitemmodel.h>
+#include <qlist.h>
+#include <qhash.h>
+#include <qmap.h>
+#include <qpair.h>
+#include <qtimer.h>
+#include <qurl.h>
+
+class TransferQueue : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum State { Queued, Running, Paused, Finished, Failed, Cancelled };
+    enum Priority { Low, Normal, High };
+    enum Policy { FirstInFirstOut, SmallestFirst, LargestFirst };
+
+    struct Item {
+        Item() : id(0), direction(0), port(21), size(-1), done(0),
+            priority(Normal), state(Queued) {}
+        int id;
+        int direction;
+        QString host;
+        int port;
+        QString userName;
+        QString remotePath;
+        QString localPath;
+        qint64 size;
+        qint64 done;
+        Priority priority;
+        State state;
+    };
+
+    TransferQueue(const QString &fileName, QObject *parent = 0);
+    ~TransferQueue();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const;
+    QVariant data(const QModelIndex &index, int role) const;
+    QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const;
+
+    Policy policy() const;
+    void setPolicy(Policy policy);
+
+    int add(const Item &item);
+    bool contains(int id) const;
+    Item item(int id) const;
+    int id(const QModelIndex &index) const;
+    QList<Item> items() const;
+
+    int next(const QUrl &url) const;
+    int count(State state) const;
+
+    void setState(int id, State state);
+    void setProgress(int id, qint64 done, qint64 size);
+
+public slots:
+    void setPriority(int id, TransferQueue::Priority priority);
+    void pause(int id);
+    void resume(int id);
+    void cancel(int id);
+    void removeFinished();
+    void sync();
+
+signals:
+    void queued();
+    void stopRequested(int id);
+
+private:
+    QString path;
+    typedef QPair<qint64, int> PendingKey;
+
+    QList<Item> queue;
+    QHash<int, int> rows;                   // id to row
+    QMap<PendingKey, int> pending[High + 1];  // queued ids per priority, in policy order
+    int states[Cancelled + 1];
+    Policy order;
+    int lastId;
+    QTimer syncTimer;
+
+    int row(int id) const;
+    void changed(int row);
+    PendingKey pendingKey(const Item &item) const;
+    void track(const Item &item);
+    void untrack(const Item &item);
+    void removeItems(const QList<int> &doomed);
+    void pruneFinished();
+    void load();
+};
+
+#endif // TRANSFERQUEUE_H
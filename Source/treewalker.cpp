@@ -0,0 +1,507 @@
+#include "treewalker.h"
+#include "transferpool.h"
+
+#include <qdir.h>
+#include <qfileinfo.h>
+#include <qdatetime.h>
+#include <qdebug.h>
+
+// Directory commands sent ahead on the session.
+static const int MaxRunning = 8;
+
+// Seconds two modification times may differ by and still be the same,
+// some file systems keep them in steps of two seconds.
+static const uint TimeSlack = 2;
+
+static QString join(const QString &dir, const QString &name)
+{
+    return dir.isEmpty() ? name : dir + "/" + name;
+}
+
+static bool removeLocal(const QFileInfo &info)
+{
+    if (!info.isDir() || info.isSymLink())
+        return QFile::remove(info.filePath());
+    QDir dir(info.filePath());
+    foreach (const QFileInfo &entry, dir.entryInfoList(QDir::Dirs | QDir::Files | QDir::Hidden
+                                                       | QDir::System | QDir::NoDotAndDotDot)) {
+        if (!removeLocal(entry))
+            return false;
+    }
+    return dir.rmdir(info.filePath());
+}
+
+/*!
+    \class TreeWalker treewalker.h
+
+    \brief The TreeWalker class transfers whole directory trees through
+    a TransferPool.
+
+    An upload creates each directory with MKD on a session of its own
+    and queues the files of a local directory as soon as the remote
+    directory exists, while its subdirectories are being created. A
+    download lists each remote directory, creates it locally and queues
+    its files before the subdirectories are listed. The tree is walked
+    one level at a time, so the first files move long before the walk
+    is over and only the directories not visited yet are kept.
+
+    sync() walks a local and a remote tree side by side and only queues
+    the files which differ in size or are newer on the side they are
+    copied from. Modification times come from the MLSD listing where the
+    server supports MLST, from MDTM where it supports that, and are not
+    compared otherwise. Synchronizing both ways copies what is missing
+    on either side and, for files that differ in size, the newer one.
+    One way, what is only on the target can be deleted.
+
+    Links to directories are not followed. done() is emitted when every
+    directory has been walked; the files may still be transferring then.
+
+    \sa TransferPool
+*/
+
+TreeWalker::TreeWalker(TransferPool *pool, QObject *parent)
+    : QObject(parent), pool(pool), ftp(0), loggingIn(false), current(0)
+{
+}
+
+TreeWalker::~TreeWalker()
+{
+    delete ftp;
+}
+
+/*!
+    Sets the server and the credentials to \a url. Walks on another
+    server are given up.
+ */
+void TreeWalker::setUrl(const QUrl &url)
+{
+    if (url == ftpUrl)
+        return;
+    abort();
+    ftpUrl = url;
+}
+
+/*!
+    Uploads the local directory \a localDir with everything below it as
+    \a remoteDir.
+ */
+void TreeWalker::upload(const QString &localDir, const QString &remoteDir)
+{
+    queue(MakeDir, remoteDir, localDir);
+    pump();
+}
+
+/*!
+    Downloads the remote directory \a remoteDir with everything below it
+    as \a localDir.
+ */
+void TreeWalker::download(const QString &remoteDir, const QString &localDir)
+{
+    queue(List, remoteDir, localDir);
+    pump();
+}
+
+/*!
+    Brings the contents of \a localDir and \a remoteDir in line in
+    \a direction, transferring only what differs. Going one way, entries
+    found only on the target are removed if \a deleteExtraneous is true.
+ */
+void TreeWalker::sync(const QString &localDir, const QString &remoteDir,
+                      SyncDirection direction, bool deleteExtraneous)
+{
+    Step like;
+    like.direction = direction;
+    like.prune = deleteExtraneous && direction != BothWays;
+    if (direction == ToLocal && !QDir().mkpath(localDir)) {
+        qWarning() << "TreeWalker" << "cannot create" << localDir;
+        return;
+    }
+    queue(Compare, remoteDir, localDir, like);
+    pump();
+}
+
+/*!
+    Returns true if no tree is being walked.
+ */
+bool TreeWalker::isIdle() const
+{
+    return waiting.isEmpty() && running.isEmpty();
+}
+
+/*!
+    Gives up all walks and closes the session. Files already handed to
+    the pool are left to it.
+ */
+void TreeWalker::abort()
+{
+    bool busy = !isIdle();
+    waiting.clear();
+    running.clear();
+    removals.clear();
+    collected.clear();
+    replies.clear();
+    current = 0;
+    loggingIn = false;
+    if (ftp) {
+        ftp->disconnect(this);
+        ftp->abort();
+        ftp->close();
+        ftp->deleteLater();
+        ftp = 0;
+    }
+    if (busy)
+        emit done();
+}
+
+void TreeWalker::queue(Kind kind, const QString &remotePath, const QString &localPath,
+                       const Step &like)
+{
+    Step step = like;
+    step.kind = kind;
+    step.remotePath = remotePath;
+    step.localPath = localPath;
+    waiting.append(step);
+}
+
+void TreeWalker::pump()
+{
+    if (waiting.isEmpty() || ftpUrl.isEmpty())
+        return;
+    if (!ftp) {
+        ftp = new FtpEngine(this);
+        connect(ftp, SIGNAL(stateChanged(int)), this, SLOT(stateChanged(int)));
+        connect(ftp, SIGNAL(commandStarted(int)), this, SLOT(commandStarted(int)));
+        connect(ftp, SIGNAL(listInfos(int, const FtpListing &)),
+                this, SLOT(listInfos(int, const FtpListing &)));
+        connect(ftp, SIGNAL(rawCommandReply(int, const QString &)),
+                this, SLOT(rawCommandReply(int, const QString &)));
+        connect(ftp, SIGNAL(commandFinished(int, bool)), this, SLOT(commandFinished(int, bool)));
+    }
+    if (ftp->state() == QFtp::Unconnected && !loggingIn) {
+        loggingIn = true;
+        ftp->connectToHost(ftpUrl.host(), ftpUrl.port(21));
+        ftp->login(ftpUrl.userName(), ftpUrl.password());
+        return;
+    }
+    if (ftp->state() != QFtp::LoggedIn)
+        return;
+    while (running.count() < MaxRunning && !waiting.isEmpty()) {
+        Step step = waiting.takeFirst();
+        int id;
+        switch (step.kind) {
+        case MakeDir: id = ftp->ensureDir(step.remotePath); break;
+        case ModifiedTime: id = ftp->rawCommand("MDTM " + step.remotePath); break;
+        case Remove: id = ftp->remove(step.remotePath); break;
+        case RemoveDir: id = ftp->rmdir(step.remotePath); break;
+        default: id = ftp->list(step.remotePath); break;
+        }
+        running.insert(id, step);
+    }
+}
+
+void TreeWalker::stateChanged(int state)
+{
+    if (state == QFtp::LoggedIn) {
+        loggingIn = false;
+        pump();
+    } else if (state == QFtp::Unconnected) {
+        // Sent again on the next session.
+        loggingIn = false;
+        QList<Step> again = running.values();
+        running.clear();
+        waiting = again + waiting;
+        current = 0;
+        collected.clear();
+        replies.clear();
+    }
+}
+
+void TreeWalker::commandStarted(int id)
+{
+    if (running.contains(id))
+        current = id;
+}
+
+/*!
+    Collects the entries of the listing \a id. Up to MaxRunning listings
+    are pipelined on the session, so entries are kept apart by the
+    command they belong to.
+ */
+void TreeWalker::listInfos(int id, const FtpListing &infos)
+{
+    if (running.contains(id))
+        collected[id] += infos;
+}
+
+void TreeWalker::rawCommandReply(int code, const QString &detail)
+{
+    if (current && code == 213)
+        replies.insert(current, detail.trimmed());
+}
+
+void TreeWalker::commandFinished(int id, bool error)
+{
+    if (loggingIn && error) {
+        qWarning() << "TreeWalker" << ftp->errorString();
+        abort();
+        return;
+    }
+    if (!running.contains(id))
+        return;
+    Step step = running.take(id);
+    FtpListing infos = collected.take(id);
+    QString reply = replies.take(id);
+    current = 0;
+
+    if (error) {
+        // The engine dropped what was sent behind the failed command.
+        QList<Step> again = running.values();
+        running.clear();
+        collected.clear();
+        replies.clear();
+        waiting = again + waiting;
+    }
+    switch (step.kind) {
+    case MakeDir:
+        // A refused MKD, most often for a directory that is there
+        // already, does not stop the pipeline; uploads into a missing
+        // one fail on their own.
+        walkLocal(step);
+        break;
+    case ModifiedTime: {
+        // Nothing is copied on a time that was not answered.
+        if (error) {
+            qWarning() << "TreeWalker" << step.remotePath << ftp->errorString();
+            break;
+        }
+        // YYYYMMDDHHMMSS[.sss] in UTC
+        QDateTime modified = QDateTime::fromString(reply.left(14), "yyyyMMddHHmmss");
+        modified.setTimeSpec(Qt::UTC);
+        syncFile(step, QFileInfo(step.localPath), step.size,
+                 modified.isValid() ? modified.toTime_t() : 0);
+        break;
+    }
+    case Remove:
+        if (error)
+            qWarning() << "TreeWalker" << step.remotePath << ftp->errorString();
+        break;
+    case RemoveDir:
+        if (error)
+            qWarning() << "TreeWalker" << step.remotePath << ftp->errorString();
+        removed(step);
+        break;
+    default:
+        // A listing is only walked once its own LIST succeeded, what an
+        // error dropped is listed again from the start.
+        if (error) {
+            qWarning() << "TreeWalker" << step.remotePath << ftp->errorString();
+            if (step.kind == RemoveTree)
+                removed(step);
+        } else if (step.kind == List) {
+            walkRemote(step, infos);
+        } else if (step.kind == Compare) {
+            walkSync(step, infos);
+        } else {
+            walkRemoval(step, infos);
+        }
+        break;
+    }
+    finishStep();
+}
+
+/*!
+    Queues the files of the local directory of \a step and the creation
+    of its subdirectories.
+ */
+void TreeWalker::walkLocal(const Step &step)
+{
+    QDir dir(step.localPath);
+    QFileInfoList entries = dir.entryInfoList(QDir::Dirs | QDir::Files | QDir::Hidden
+                                              | QDir::NoDotAndDotDot, QDir::Name);
+    foreach (const QFileInfo &entry, entries) {
+        QString remotePath = join(step.remotePath, entry.fileName());
+        if (entry.isDir()) {
+            if (!entry.isSymLink())
+                queue(MakeDir, remotePath, entry.filePath());
+        } else {
+            pool->upload(entry.filePath(), remotePath);
+        }
+    }
+}
+
+/*!
+    Creates the local directory of \a step, queues the files listed in
+    \a infos and the listings of the subdirectories.
+ */
+void TreeWalker::walkRemote(const Step &step, const FtpListing &infos)
+{
+    if (!QDir().mkpath(step.localPath)) {
+        qWarning() << "TreeWalker" << "cannot create" << step.localPath;
+        return;
+    }
+    foreach (const QUrlInfo &info, infos) {
+        if (info.name() == "." || info.name() == "..")
+            continue;
+        QString remotePath = join(step.remotePath, info.name());
+        QString localPath = join(step.localPath, info.name());
+        if (info.isDir()) {
+            if (!info.isSymLink())
+                queue(List, remotePath, localPath);
+        } else {
+            pool->download(remotePath, localPath, info.size());
+        }
+    }
+}
+
+/*!
+    Compares the remote directory listed in \a infos with the local one
+    of \a step and queues what has to be copied or removed.
+ */
+void TreeWalker::walkSync(const Step &step, const FtpListing &infos)
+{
+    QHash<QString, QFileInfo> locals;
+    QDir dir(step.localPath);
+    foreach (const QFileInfo &entry, dir.entryInfoList(QDir::Dirs | QDir::Files | QDir::Hidden
+                                                       | QDir::NoDotAndDotDot, QDir::Name))
+        locals.insert(entry.fileName(), entry);
+
+    // MLSD times are exact, LIST times are too coarse to compare.
+    bool listedTimes = ftp->hasFeature("MLST");
+    bool askTimes = !listedTimes && ftp->hasFeature("MDTM");
+
+    foreach (const QUrlInfo &info, infos) {
+        if (info.name() == "." || info.name() == ".." || (info.isDir() && info.isSymLink()))
+            continue;
+        QString remotePath = join(step.remotePath, info.name());
+        QString localPath = join(step.localPath, info.name());
+        bool present = locals.contains(info.name());
+        QFileInfo local = locals.take(info.name());
+
+        if (present && local.isDir() != info.isDir()) {
+            qWarning() << "TreeWalker" << "file and directory" << remotePath;
+        } else if (present && info.isDir()) {
+            if (!local.isSymLink())
+                queue(Compare, remotePath, localPath, step);
+        } else if (present) {
+            // Differing sizes decide alone one way, equal ones both ways.
+            bool sameSize = local.size() == info.size();
+            if (askTimes && sameSize == (step.direction != BothWays)) {
+                Step ask = step;
+                ask.size = info.size();
+                queue(ModifiedTime, remotePath, localPath, ask);
+            } else {
+                Step file = step;
+                file.remotePath = remotePath;
+                file.localPath = localPath;
+                syncFile(file, local, info.size(),
+                         listedTimes && info.lastModified().isValid()
+                         ? info.lastModified().toTime_t() : 0);
+            }
+        } else if (step.direction != ToRemote) {
+            if (info.isDir())
+                queue(List, remotePath, localPath);
+            else
+                pool->download(remotePath, localPath, info.size());
+        } else if (step.prune) {
+            queue(info.isDir() ? RemoveTree : Remove, remotePath, QString());
+        }
+    }
+
+    foreach (const QFileInfo &local, locals) {
+        if (step.direction != ToLocal) {
+            QString remotePath = join(step.remotePath, local.fileName());
+            if (!local.isDir())
+                pool->upload(local.filePath(), remotePath);
+            else if (!local.isSymLink())
+                queue(MakeDir, remotePath, local.filePath());
+        } else if (step.prune && !removeLocal(local)) {
+            qWarning() << "TreeWalker" << "cannot remove" << local.filePath();
+        }
+    }
+}
+
+/*!
+    Copies the file of \a step in its direction if \a local and the
+    remote file of \a remoteSize bytes, modified at \a remoteModified or
+    0 if not known, differ.
+ */
+void TreeWalker::syncFile(const Step &step, const QFileInfo &local, qint64 remoteSize,
+                          uint remoteModified)
+{
+    uint localModified = local.lastModified().toTime_t();
+    bool known = remoteModified != 0;
+    bool sameSize = local.size() == remoteSize;
+    bool localNewer = known && localModified > remoteModified + TimeSlack;
+    bool remoteNewer = known && remoteModified > localModified + TimeSlack;
+
+    switch (step.direction) {
+    case ToRemote:
+        if (!sameSize || localNewer)
+            pool->upload(step.localPath, step.remotePath);
+        break;
+    case ToLocal:
+        if (!sameSize || remoteNewer)
+            pool->download(step.remotePath, step.localPath, remoteSize);
+        break;
+    case BothWays:
+        // A copy is newer than what it was copied from, equal sizes are
+        // taken as the same file.
+        if (sameSize)
+            break;
+        if (remoteNewer)
+            pool->download(step.remotePath, step.localPath, remoteSize);
+        else if (localNewer)
+            pool->upload(step.localPath, step.remotePath);
+        else
+            qWarning() << "TreeWalker" << "cannot tell which is newer" << step.remotePath;
+        break;
+    }
+}
+
+/*!
+    Queues the removal of everything in the remote directory of \a step,
+    listed in \a infos. The directory itself goes once its
+    subdirectories are gone.
+ */
+void TreeWalker::walkRemoval(const Step &step, const FtpListing &infos)
+{
+    int subdirs = 0;
+    foreach (const QUrlInfo &info, infos) {
+        if (info.name() == "." || info.name() == "..")
+            continue;
+        QString remotePath = join(step.remotePath, info.name());
+        if (info.isDir() && !info.isSymLink()) {
+            queue(RemoveTree, remotePath, QString());
+            ++subdirs;
+        } else {
+            queue(Remove, remotePath, QString());
+        }
+    }
+    if (subdirs)
+        removals.insert(step.remotePath, subdirs);
+    else
+        queue(RemoveDir, step.remotePath, QString());
+}
+
+/*!
+    Removes the parent of the directory of \a step once it has no more
+    subdirectories.
+ */
+void TreeWalker::removed(const Step &step)
+{
+    QString parent = step.remotePath.section('/', 0, -2);
+    if (!removals.contains(parent))
+        return;
+    if (--removals[parent] == 0) {
+        removals.remove(parent);
+        queue(RemoveDir, parent, QString());
+    }
+}
+
+void TreeWalker::finishStep()
+{
+    if (isIdle())
+        emit done();
+    else
+        pump();
+}
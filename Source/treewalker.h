@@ -0,0 +1,88 @@
+#ifndef TREEWALKER_H
+#define TREEWALKER_H
+
+#include <qobject.h>
+#include <qlist.h>
+#include <qmap.h>
+#include <qhash.h>
+#include <qurl.h>
+
+#include "ftpengine.h"
+
+class QFileInfo;
+class TransferPool;
+
+class TreeWalker : public QObject
+{
+    Q_OBJECT
+
+public:
+    enum SyncDirection { ToRemote, ToLocal, BothWays };
+
+    TreeWalker(TransferPool *pool, QObject *parent = 0);
+    ~TreeWalker();
+
+    void setUrl(const QUrl &url);
+
+    void upload(const QString &localDir, const QString &remoteDir);
+    void download(const QString &remoteDir, const QString &localDir);
+    void sync(const QString &localDir, const QString &remoteDir, SyncDirection direction,
+              bool deleteExtraneous = false);
+
+    bool isIdle() const;
+
+public slots:
+    void abort();
+
+signals:
+    void done();
+
+private slots:
+    void stateChanged(int state);
+    void commandStarted(int id);
+    void listInfos(int id, const FtpListing &infos);
+    void rawCommandReply(int code, const QString &detail);
+    void commandFinished(int id, bool error);
+
+private:
+    enum Kind { MakeDir, List, Compare, ModifiedTime, Remove, RemoveTree, RemoveDir };
+
+    struct Step {
+        Step() : kind(List), direction(ToRemote), prune(false), size(-1) {}
+        Kind kind;
+        QString remotePath;
+        QString localPath;
+        SyncDirection direction;
+        bool prune;
+        qint64 size;    // of the remote file whose time is asked for
+    };
+
+    TransferPool *pool;
+    FtpEngine *ftp;
+    QUrl ftpUrl;
+    bool loggingIn;
+
+    QList<Step> waiting;
+    QMap<int, Step> running;
+    QHash<int, FtpListing> collected;   // by command id, until it finishes
+    QHash<int, QString> replies;
+    int current;
+
+    // Remote directories being removed and how many of their
+    // subdirectories are still there.
+    QHash<QString, int> removals;
+
+    void pump();
+    void queue(Kind kind, const QString &remotePath, const QString &localPath,
+               const Step &like = Step());
+    void walkLocal(const Step &step);
+    void walkRemote(const Step &step, const FtpListing &infos);
+    void walkSync(const Step &step, const FtpListing &infos);
+    void walkRemoval(const Step &step, const FtpListing &infos);
+    void removed(const Step &step);
+    void syncFile(const Step &step, const QFileInfo &local, qint64 remoteSize,
+                  uint remoteModified);
+    void finishStep();
+};
+
+#endif // TREEWALKER_H
@@ -1,6 +1,9 @@
 #include "window.h"
 #include "ui_window.h"
 #include "ftpmodel.h"
+#include "transferpool.h"
+#include "treewalker.h"
+#include <climits>
 
 
 window::window(QWidget *parent) :
@@ -11,10 +14,34 @@ window::window(QWidget *parent) :
 
     model = new QDirModel(this);
     ftpmodel =new FtpModel(this);
+    transferPool = new TransferPool(this);
+    treeWalker = new TreeWalker(transferPool, this);
+    QSettings settings;
+    transferPool->setSessionCount(settings.value("transfer/sessions", 4).toInt());
+    transferPool->setSegmentCount(settings.value("transfer/segments", 4).toInt());
+    transferPool->setSegmentThreshold(settings.value("transfer/segmentThreshold", 64 * 1024 * 1024).toLongLong());
+    transferPool->setRetryCount(settings.value("transfer/retries", 3).toInt());
+    transferPool->setDirectIoThreshold(settings.value("transfer/directIoThreshold", 0).toLongLong());
+    transferPool->setVerification(settings.value("transfer/verify", false).toBool());
+    transferPool->setSkipIdentical(settings.value("transfer/skipIdentical", false).toBool());
+    transferPool->setCompressionLevel(settings.value("transfer/compression", 0).toInt());
+    ftpmodel->setPageSize(settings.value("listing/pageSize", 1000).toInt());
+    ftpmodel->setHiddenLimit(settings.value("listing/hiddenLimit", 100000).toInt());
+    ftpmodel->setCacheTimeToLive(settings.value("listing/cacheTtl", 24 * 60 * 60).toInt());
+    ftpmodel->prefetcher.setConcurrency(settings.value("listing/prefetchConcurrency", 2).toInt());
+    ftpmodel->prefetcher.setDepth(settings.value("listing/prefetchDepth", 1).toInt());
+    ftpmodel->prefetcher.setEnabled(settings.value("listing/prefetch", false).toBool());
+    ftpmodel->setRecheckInterval(settings.value("listing/recheckInterval", 0).toInt());
+    ftpmodel->keeper.setKeepAliveInterval(settings.value("connection/keepAlive", 60).toInt() * 1000);
+    transferPool->setKeepAliveInterval(settings.value("connection/keepAlive", 60).toInt() * 1000);
+    QString policy = settings.value("transfer/policy", "fifo").toString();
+    if(policy == "smallest") transferPool->transferQueue()->setPolicy(TransferQueue::SmallestFirst);
+    else if(policy == "largest") transferPool->transferQueue()->setPolicy(TransferQueue::LargestFirst);
     connectStatus=false;
 
     ui->localView->setModel(model);
     ui->remoteView->setModel(ftpmodel);
+    ui->queueView->setModel(transferPool->transferQueue());
 
     connect(ui->usernameLine,SIGNAL(textChanged(const QString &)),
             this,SLOT(activateConnect()));
@@ -34,6 +61,10 @@ window::window(QWidget *parent) :
             this,SLOT(dis_connect()));
     connect(&(this->ftpmodel->connection),SIGNAL(stateChanged(int)),
             this,SLOT(getAction(int)));
+    connect(ui->remoteView,SIGNAL(expanded(const QModelIndex &)),
+            ftpmodel,SLOT(directoryExpanded(const QModelIndex &)));
+    connect(ui->remoteView,SIGNAL(collapsed(const QModelIndex &)),
+            ftpmodel,SLOT(directoryCollapsed(const QModelIndex &)));
 
     connect(ui->toRemoteButton,SIGNAL(clicked()),
             this,SLOT(upload()));
@@ -41,8 +72,20 @@ window::window(QWidget *parent) :
             this,SLOT(download()));
     connect(&(this->ftpmodel->connection),SIGNAL(commandFinished(int,bool)),
             this,SLOT(commandManage(int,bool)));
-    connect(&(this->ftpmodel->connection),SIGNAL(dataTransferProgress(qint64,qint64)),
+    connect(transferPool,SIGNAL(transferFinished(int,bool)),
+            this,SLOT(transferManage(int,bool)));
+    connect(transferPool,SIGNAL(transferVerified(int,bool)),
+            this,SLOT(verifyManage(int,bool)));
+    connect(transferPool,SIGNAL(dataTransferProgress(qint64,qint64)),
             this,SLOT(changeProgressBar(qint64,qint64)));
+    connect(transferPool,SIGNAL(done()),
+            this,SLOT(refreshTargets()));
+    connect(treeWalker,SIGNAL(done()),
+            this,SLOT(refreshTargets()));
+    connect(ui->queueView,SIGNAL(customContextMenuRequested(const QPoint &)),
+            this,SLOT(queueMenu(const QPoint &)));
+    connect(ui->localView,SIGNAL(customContextMenuRequested(const QPoint &)),
+            this,SLOT(syncMenu(const QPoint &)));
 }
 
 window::~window()
@@ -99,13 +142,18 @@ void window::dis_connect()
     {
         url = QString("ftp://%1:%2@%3").arg(ui->usernameLine->text()).arg(ui->passwordLine->text()).arg(ui->hostnameLine->text());
         this->ftpmodel->setUrl(url);
+        transferPool->setUrl(url);
+        treeWalker->setUrl(url);
         this->ftpmodel->connection.connectToHost(url.host(), url.port(21));
+        this->ftpmodel->connection.login(url.userName(), url.password());
         ui->remoteView->setModel(ftpmodel);
 
     }
     else if(connectStatus)
     {
-        this->ftpmodel->connection.close();
+        treeWalker->abort();
+        transferPool->abortAll();
+        this->ftpmodel->keeper.close();
 
     }
 }
@@ -115,6 +163,11 @@ void window::getAction(int state)
     switch(state)
     {
     case 0:
+        if(ftpmodel->keeper.isReconnecting())
+        {
+            ui->watermarkLabel->setText("Connection lost, reconnecting... - Eyll Tasyrek & Sekin Savasi @ 2010");
+            break;
+        }
         ui->connectionButton->setText("&Connect ");
         ui->watermarkLabel->setText("Disconnected - Eyll Tasyrek & Sekin Savasi @ 2010");
         connectStatus=false;
@@ -133,34 +186,78 @@ void window::getAction(int state)
         break;
     case 4:
         ui->watermarkLabel->setText("Connected & Logged in - Eyll Tasyrek & Sekin Savasi @ 2010");
+        restoreExpanded();
+        if(transferPool->resumableCount())
+            switch(QMessageBox::question(this,
+                                         tr("Interrupted transfers"),
+                                         tr("%1 transfer(s) to this server were interrupted."
+                                            "\nDo you want to resume them?")
+                                         .arg(transferPool->resumableCount()),
+                                         tr("&Yes"),tr("&No"),
+                                         QString::null, 0, 1 ))
+            {
+            case 0:
+                transferPool->resumePending();
+                break;
+            case 1:
+                transferPool->discardPending();
+                break;
+            }
         break;
     case 5:
         ui->watermarkLabel->setText("Disconnecting - Eyll Tasyrek & Sekin Savasi @ 2010");
         break;
     }
 }
+// Expand what was expanded last time on this server, the listings come
+// from the cache so the tree is back at once
+void window::restoreExpanded()
+{
+    foreach(const QString &path, ftpmodel->expandedPaths())
+    {
+        QModelIndex index = ftpmodel->index(path);
+        if(!index.isValid())
+            continue;
+        if(ftpmodel->canFetchMore(index))
+            ftpmodel->fetchMore(index);
+        ui->remoteView->expand(index);
+    }
+}
+
 void window::commandManage(int id,bool error)
 {
     qDebug() <<"commandmanage" << id << error;
     qDebug() << ftpmodel->connection.currentCommand();
     if(error) ui->watermarkLabel->setText("Error Occured, Please Retry! - Eyll Tasyrek & Sekin Savasi @ 2010");
 
-    else if(ftpmodel->connection.currentCommand() == QFtp::Put) ui->watermarkLabel->setText("Uploaded - Eyll Tasyrek & Sekin Savasi @ 2010");
-    else if(ftpmodel->connection.currentCommand() == QFtp::Get) ui->watermarkLabel->setText("Downloaded - Eyll Tasyrek & Sekin Savasi @ 2010");
+}
+
+void window::transferManage(int id,bool error)
+{
+    qDebug() <<"transfermanage" << id << error;
+    if(error) ui->watermarkLabel->setText("Error Occured, Please Retry! - Eyll Tasyrek & Sekin Savasi @ 2010");
+    else if(transferPool->pendingCount() > 0) ui->watermarkLabel->setText(QString("%1 transfer(s) left - Eyll Tasyrek & Sekin Savasi @ 2010").arg(transferPool->pendingCount()));
+    else if(transferPool->direction(id) == TransferPool::Upload) ui->watermarkLabel->setText("Uploaded - Eyll Tasyrek & Sekin Savasi @ 2010");
+    else ui->watermarkLabel->setText("Downloaded - Eyll Tasyrek & Sekin Savasi @ 2010");
+}
+
+void window::verifyManage(int id,bool match)
+{
+    qDebug() <<"verifymanage" << id << match;
+    if(!match) ui->watermarkLabel->setText("Checksum Mismatch, Please Retry! - Eyll Tasyrek & Sekin Savasi @ 2010");
 }
 
 void window::changeProgressBar(qint64 value,qint64 max)
 {
-    if(this->ftpmodel->connection.currentCommand() == QFtp::Get )
-    ui->progressBar->setInvertedAppearance(true);
-    if(this->ftpmodel->connection.currentCommand() == QFtp::Put )
-        ui->progressBar->setInvertedAppearance(false);
+    // QProgressBar counts in int, scale multi-GB batches down
+    while(max > INT_MAX) { value >>= 10; max >>= 10; }
     ui->progressBar->setValue(value);
     if(max != ui->progressBar->maximum())ui->progressBar->setMaximum(max);
 }
 
 void window::upload()
-{   QItemSelectionModel *selectionModel = ui->localView->selectionModel();
+{   ui->progressBar->setInvertedAppearance(false);
+    QItemSelectionModel *selectionModel = ui->localView->selectionModel();
     QModelIndexList selectedOnes = selectionModel->selectedRows();
     QItemSelectionModel *destinationSelectionModel = ui->remoteView->selectionModel();
     QModelIndexList destination = destinationSelectionModel->selectedRows();
@@ -174,31 +271,127 @@ void window::upload()
                 qDebug() << ftpmodel->filePath(destination[j]);
                 qDebug() << ftpmodel->filePath(ftpmodel->parent(destination[j]));
 
-                QFile *file= new QFile(model->filePath(selectedOnes[i]));
+                QString remoteDir;
                 if(ftpmodel->isDir(destination[j]))
-                   this->ftpmodel->connection.cd(ftpmodel->filePath(destination[j]));
+                   remoteDir = ftpmodel->filePath(destination[j]);
                 else
-                   this->ftpmodel->connection.cd(ftpmodel->filePath(ftpmodel->parent(destination[j])));
+                   remoteDir = ftpmodel->filePath(ftpmodel->parent(destination[j]));
+                uploadTargets << remoteDir;
+                if(!remoteDir.isEmpty()) remoteDir += "/";
 
-                this->ftpmodel->connection.put(file,model->fileName(selectedOnes[i]));
+                // Folders are walked, their files start while deeper levels are created
+                if(model->isDir(selectedOnes[i]))
+                    treeWalker->upload(model->filePath(selectedOnes[i]),remoteDir + model->fileName(selectedOnes[i]));
+                else
+                    transferPool->upload(model->filePath(selectedOnes[i]),remoteDir + model->fileName(selectedOnes[i]));
                 ui->watermarkLabel->setText(QString("Uploading %1 of %2 file(s) to destination %3 - Eyll Tasyrek & Sekin Savasi @ 2010").arg(i+1).arg(selectedOnes.size()).arg(j+1));
             }
         else
             {
                 qDebug() << model->filePath(selectedOnes[i]);
-                QFile *file= new QFile(model->filePath(selectedOnes[i]));
-                this->ftpmodel->connection.put(file,model->fileName(selectedOnes[i]));
+                uploadTargets << QString();
+                if(model->isDir(selectedOnes[i]))
+                    treeWalker->upload(model->filePath(selectedOnes[i]),model->fileName(selectedOnes[i]));
+                else
+                    transferPool->upload(model->filePath(selectedOnes[i]),model->fileName(selectedOnes[i]));
                 ui->watermarkLabel->setText(QString("Uploading %1 of %2 file(s) - Eyll Tasyrek & Sekin Savasi @ 2010").arg(i+1).arg(selectedOnes.size()));
             }
     }
+}
 
-    this->ftpmodel->connection.close();
-    connectStatus=false;
-    this->dis_connect();
+void window::refreshTargets()
+{
+    uploadTargets.removeDuplicates();
+    foreach(const QString &path, uploadTargets)
+        ftpmodel->refresh(path.isEmpty() ? QModelIndex() : ftpmodel->index(path));
+    uploadTargets.clear();
+}
+
+void window::queueMenu(const QPoint &pos)
+{
+    TransferQueue *queue = transferPool->transferQueue();
+    QList<int> ids;
+    foreach(const QModelIndex &index, ui->queueView->selectionModel()->selectedRows())
+        ids << queue->id(index);
+
+    QMenu menu;
+    QAction *pause = menu.addAction(tr("&Pause"));
+    QAction *resume = menu.addAction(tr("&Resume"));
+    QAction *cancel = menu.addAction(tr("&Cancel"));
+    menu.addSeparator();
+    QAction *high = menu.addAction(tr("&High Priority"));
+    QAction *normal = menu.addAction(tr("&Normal Priority"));
+    QAction *low = menu.addAction(tr("&Low Priority"));
+    menu.addSeparator();
+    QAction *clear = menu.addAction(tr("Remove &Finished"));
+    if(ids.isEmpty())
+    {
+        pause->setEnabled(false); resume->setEnabled(false); cancel->setEnabled(false);
+        high->setEnabled(false); normal->setEnabled(false); low->setEnabled(false);
+    }
+
+    QAction *chosen = menu.exec(ui->queueView->viewport()->mapToGlobal(pos));
+    if(chosen == clear) queue->removeFinished();
+    foreach(int id, ids)
+    {
+        if(chosen == pause) queue->pause(id);
+        else if(chosen == resume) queue->resume(id);
+        else if(chosen == cancel) queue->cancel(id);
+        else if(chosen == high) queue->setPriority(id, TransferQueue::High);
+        else if(chosen == normal) queue->setPriority(id, TransferQueue::Normal);
+        else if(chosen == low) queue->setPriority(id, TransferQueue::Low);
+    }
+}
+
+// Synchronizes the selected local folder with the selected remote one, or
+// with the top of the server when nothing is selected there
+void window::syncMenu(const QPoint &pos)
+{
+    QModelIndexList local = ui->localView->selectionModel()->selectedRows();
+    QModelIndexList remote = ui->remoteView->selectionModel()->selectedRows();
+    QString localDir = local.size() == 1 && model->isDir(local[0]) ? model->filePath(local[0]) : QString();
+    QString remoteDir;
+    bool remoteOk = remote.isEmpty();
+    if(remote.size() == 1 && ftpmodel->isDir(remote[0]))
+    {
+        remoteDir = ftpmodel->filePath(remote[0]);
+        remoteOk = true;
+    }
+
+    QMenu menu;
+    QAction *toRemote = menu.addAction(tr("&Mirror to Server"));
+    QAction *toLocal = menu.addAction(tr("Mirror from &Server"));
+    QAction *both = menu.addAction(tr("Synchronize &Both Ways"));
+    menu.addSeparator();
+    QAction *prune = menu.addAction(tr("&Delete Extraneous Files When Mirroring"));
+    prune->setCheckable(true);
+    prune->setChecked(QSettings().value("sync/deleteExtraneous", false).toBool());
+    if(!connectStatus || localDir.isEmpty() || !remoteOk)
+    {
+        toRemote->setEnabled(false); toLocal->setEnabled(false); both->setEnabled(false);
+    }
+
+    QAction *chosen = menu.exec(ui->localView->viewport()->mapToGlobal(pos));
+    if(chosen == prune)
+    {
+        QSettings().setValue("sync/deleteExtraneous", prune->isChecked());
+        return;
+    }
+    TreeWalker::SyncDirection direction;
+    if(chosen == toRemote) direction = TreeWalker::ToRemote;
+    else if(chosen == toLocal) direction = TreeWalker::ToLocal;
+    else if(chosen == both) direction = TreeWalker::BothWays;
+    else return;
+
+    if(direction != TreeWalker::ToLocal) uploadTargets << remoteDir;
+    ui->progressBar->setInvertedAppearance(direction == TreeWalker::ToLocal);
+    ui->watermarkLabel->setText("Comparing folders... - Eyll Tasyrek & Sekin Savasi @ 2010");
+    treeWalker->sync(localDir, remoteDir, direction, prune->isChecked());
 }
 
 void window::download()
 {
+    ui->progressBar->setInvertedAppearance(true);
     QItemSelectionModel *selectionModel = ui->remoteView->selectionModel();
     QModelIndexList selectedOnes = selectionModel->selectedRows();
     QItemSelectionModel *destinationSelectionModel = ui->localView->selectionModel();
@@ -215,7 +408,7 @@ void window::download()
             qDebug() << "parent: " << model->filePath(model->parent(destination[j]));
 
         //QFile *downloaded = new QFile(ftpmodel->filePath(selectedOnes[i]));
-        QFile *downloaded = new QFile(QString("%1%2%3").arg(model->filePath(destination[j])).arg("/").arg(ftpmodel->fileName(selectedOnes[i])));
+        QString downloaded = QString("%1%2%3").arg(model->filePath(destination[j])).arg("/").arg(ftpmodel->fileName(selectedOnes[i]));
         if (QFile::exists(QString("%1%2%3").arg(model->filePath(destination[j])).arg("/").arg(ftpmodel->fileName(selectedOnes[i]))))
             {
                  switch(QMessageBox::question(this,
@@ -233,20 +426,15 @@ void window::download()
                  return;
                  }
              }
-        if (!downloaded->open(QIODevice::WriteOnly)) {
-                 QMessageBox::information(this, tr("FTP"),
-                                          tr("Unable to save the file %1.")
-                                          .arg(downloaded->errorString()));
-                 delete downloaded;
-                 return;
-             }
-
-        this->ftpmodel->connection.get(ftpmodel->filePath(selectedOnes[i]),downloaded);
+        if(ftpmodel->isDir(selectedOnes[i]))
+            treeWalker->download(ftpmodel->filePath(selectedOnes[i]),downloaded);
+        else
+            transferPool->download(ftpmodel->filePath(selectedOnes[i]),downloaded,ftpmodel->fileSize(selectedOnes[i]));
 
     }
         else
         {   ui->watermarkLabel->setText(QString("Downloading to default directory : %1 of %2 file(s) - Eyll Tasyrek & Sekin Savasi @ 2010").arg(i+1).arg(selectedOnes.size()));
-            QFile *downloaded = new QFile(QString("%1%2%3").arg(QDir::currentPath()).arg("/").arg(ftpmodel->fileName(selectedOnes[i])));
+            QString downloaded = QString("%1%2%3").arg(QDir::currentPath()).arg("/").arg(ftpmodel->fileName(selectedOnes[i]));
             if (QFile::exists(QString("%1%2%3").arg(QDir::currentPath()).arg("/").arg(ftpmodel->fileName(selectedOnes[i]))))
                 {
                      switch(QMessageBox::question(this,
@@ -264,16 +452,10 @@ void window::download()
                      return;
                      }
                  }
-            if (!downloaded->open(QIODevice::WriteOnly)) {
-
-                     QMessageBox::information(this, tr("FTP"),
-                                              tr("Unable to save the file %1.")
-                                              .arg(downloaded->errorString()));
-                     delete downloaded;
-                     return;
-                 }
-
-            this->ftpmodel->connection.get(ftpmodel->filePath(selectedOnes[i]),downloaded);
+            if(ftpmodel->isDir(selectedOnes[i]))
+                treeWalker->download(ftpmodel->filePath(selectedOnes[i]),downloaded);
+            else
+                transferPool->download(ftpmodel->filePath(selectedOnes[i]),downloaded,ftpmodel->fileSize(selectedOnes[i]));
         }
 
 
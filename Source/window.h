@@ -7,6 +7,8 @@
 #include <QFileSystemModel>
 #include <QModelIndex>
 #include "ftpmodel.h"
+#include "transferpool.h"
+#include "treewalker.h"
 #include <QModelIndexList>
 #include <QItemSelectionModel>
 
@@ -35,14 +37,24 @@ private slots:
     void upload();
     void download();
     void commandManage(int,bool);
+    void transferManage(int,bool);
+    void verifyManage(int,bool);
     void changeProgressBar(qint64,qint64);
+    void refreshTargets();
+    void queueMenu(const QPoint &);
+    void syncMenu(const QPoint &);
 private:
+    void restoreExpanded();
+
     Ui::window *ui;
 
     QDirModel *model;
     FtpModel *ftpmodel;
+    TransferPool *transferPool;
+    TreeWalker *treeWalker;
     QFileSystemModel remoteModel;
     QUrl url;
+    QStringList uploadTargets;
 
     bool connectStatus;
 